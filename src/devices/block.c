@@ -3,8 +3,19 @@
 #include <string.h>
 #include <stdio.h>
 #include "devices/ide.h"
+#include "devices/timer.h"
+#include "threads/interrupt.h"
 #include "threads/malloc.h"
 
+/* An I/O scheduler, which chooses the queued request of a block
+   device to dispatch next.  Whatever it chooses, requests for
+   adjacent sectors are dispatched along with it. */
+struct block_scheduler
+  {
+    const char *name;
+    struct block_request *(*choose) (struct block *);
+  };
+
 /* A block device. */
 struct block
   {
@@ -19,6 +30,19 @@ struct block
 
     unsigned long long read_cnt;        /* Number of sectors read. */
     unsigned long long write_cnt;       /* Number of sectors written. */
+    struct block_io_stats read_stats;   /* Completed reads. */
+    struct block_io_stats write_stats;  /* Completed writes. */
+
+    /* Request queue, for drivers with a KICK operation. */
+    const struct block_scheduler *sched; /* I/O scheduler. */
+    struct lock queue_lock;             /* Protects the members below. */
+    struct list fifo;                   /* Queued requests, oldest first. */
+    struct list sorted;                 /* Queued requests, by sector. */
+    block_sector_t head;                /* Sector after the last batch. */
+    int head_dir;                       /* Last seek: 1 up, -1 down. */
+    unsigned long long batch_cnt;       /* Number of batches dispatched. */
+    unsigned long long merge_cnt;       /* Requests merged into others. */
+    unsigned long long reversal_cnt;    /* Changes of seek direction. */
   };
 
 /* List of all block devices. */
@@ -28,6 +52,9 @@ static struct list all_blocks = LIST_INITIALIZER (all_blocks);
 static struct block *block_by_role[BLOCK_ROLE_CNT];
 
 static struct block *list_elem_to_block (struct list_elem *);
+static void check_sectors (struct block *, block_sector_t, size_t cnt);
+static void transfer (struct block *, block_sector_t, size_t cnt,
+                      void *buffer, bool write);
 
 /* Returns a human-readable name for the given block device
    TYPE. */
@@ -120,9 +147,7 @@ check_sector (struct block *block, block_sector_t sector)
 void
 block_read (struct block *block, block_sector_t sector, void *buffer)
 {
-  check_sector (block, sector);
-  block->ops->read (block->aux, sector, buffer);
-  block->read_cnt++;
+  transfer (block, sector, 1, buffer, false);
 }
 
 /* Write sector SECTOR to BLOCK from BUFFER, which must contain
@@ -132,11 +157,73 @@ block_read (struct block *block, block_sector_t sector, void *buffer)
    per-block device locking is unneeded. */
 void
 block_write (struct block *block, block_sector_t sector, const void *buffer)
+{
+  transfer (block, sector, 1, (void *) buffer, true);
+}
+
+/* Verifies that the CNT sectors starting at SECTOR are valid
+   offsets within BLOCK.  Panics if not. */
+static void
+check_sectors (struct block *block, block_sector_t sector, size_t cnt)
 {
   check_sector (block, sector);
-  ASSERT (block->type != BLOCK_FOREIGN);
-  block->ops->write (block->aux, sector, buffer);
-  block->write_cnt++;
+  if (cnt > block->size - sector)
+    PANIC ("Access past end of device %s (sector=%"PRDSNu", cnt=%zu, "
+           "size=%"PRDSNu")\n", block_name (block), sector, cnt,
+           block->size);
+}
+
+/* Reads CNT consecutive sectors starting at SECTOR from BLOCK
+   into BUFFER, which must have room for CNT * BLOCK_SECTOR_SIZE
+   bytes, as a single request if the driver supports it.
+   Internally synchronizes accesses to block devices, so external
+   per-block device locking is unneeded. */
+void
+block_read_multiple (struct block *block, block_sector_t sector, size_t cnt,
+                     void *buffer)
+{
+  transfer (block, sector, cnt, buffer, false);
+}
+
+/* Writes CNT consecutive sectors starting at SECTOR to BLOCK from
+   BUFFER, which must contain CNT * BLOCK_SECTOR_SIZE bytes, as a
+   single request if the driver supports it.  Returns after the
+   block device has acknowledged receiving the data.
+   Internally synchronizes accesses to block devices, so external
+   per-block device locking is unneeded. */
+void
+block_write_multiple (struct block *block, block_sector_t sector,
+                      size_t cnt, const void *buffer)
+{
+  transfer (block, sector, cnt, (void *) buffer, true);
+}
+
+/* Transfers CNT sectors starting at SECTOR between BLOCK and
+   BUFFER, writing them if WRITE is true and reading them
+   otherwise, and waits for the transfer to complete.  Submits
+   requests of up to BLOCK_BATCH_SECTORS sectors. */
+static void
+transfer (struct block *block, block_sector_t sector, size_t cnt,
+          void *buffer, bool write)
+{
+  uint8_t *p = buffer;
+
+  if (cnt == 0)
+    return;
+  check_sectors (block, sector, cnt);
+  while (cnt > 0)
+    {
+      struct block_request r;
+      size_t n = cnt < BLOCK_BATCH_SECTORS ? cnt : BLOCK_BATCH_SECTORS;
+
+      block_request_init (&r, block, sector, n, p, write);
+      block_submit (&r);
+      block_wait (&r);
+
+      p += n * BLOCK_SECTOR_SIZE;
+      sector += n;
+      cnt -= n;
+    }
 }
 
 /* Returns the number of sectors in BLOCK. */
@@ -160,10 +247,449 @@ block_type (struct block *block)
   return block->type;
 }
 
-/* Prints statistics for each block device used for a Pintos role. */
+/* Request queues and I/O scheduling. */
+
+/* Ticks a queued read or write may wait before the deadline
+   scheduler dispatches it ahead of the elevator order.  Writes
+   can wait longer because nobody is usually waiting for them. */
+#define READ_EXPIRE (TIMER_FREQ / 2)
+#define WRITE_EXPIRE (5 * TIMER_FREQ)
+
+static struct block_request *noop_choose (struct block *);
+static struct block_request *clook_choose (struct block *);
+static struct block_request *deadline_choose (struct block *);
+
+/* Available I/O schedulers. */
+static const struct block_scheduler schedulers[] =
+  {
+    {"noop", noop_choose},
+    {"clook", clook_choose},
+    {"deadline", deadline_choose},
+  };
+#define SCHEDULER_CNT (sizeof schedulers / sizeof *schedulers)
+
+/* Scheduler for devices not named in a -iosched option. */
+static const struct block_scheduler *default_scheduler = &schedulers[2];
+
+/* Devices named in -iosched options and their schedulers. */
+#define SCHED_CHOICE_CNT 8
+static struct
+  {
+    const char *name;
+    const struct block_scheduler *sched;
+  }
+sched_choices[SCHED_CHOICE_CNT];
+static size_t sched_choice_cnt;
+
+/* Handles a -iosched=[BDEV:]SCHED option from the kernel command
+   line: selects the I/O scheduler named SCHED for block device
+   BDEV, or for all devices without a scheduler of their own if
+   BDEV is omitted.  BDEV must be a device with a request queue,
+   that is, a whole disk: a partition's requests are queued on its
+   disk.  Must be called before the devices are registered.
+   Panics if SCHED is not a known scheduler; see also
+   block_check_schedulers(). */
+void
+block_configure_scheduler (char *spec)
+{
+  const struct block_scheduler *sched = NULL;
+  char *sched_name = strchr (spec, ':');
+  size_t i;
+
+  if (sched_name != NULL)
+    *sched_name++ = '\0';
+  else
+    sched_name = spec;
+
+  for (i = 0; i < SCHEDULER_CNT; i++)
+    if (!strcmp (sched_name, schedulers[i].name))
+      sched = &schedulers[i];
+  if (sched == NULL)
+    PANIC ("unknown I/O scheduler `%s'", sched_name);
+
+  if (sched_name == spec)
+    default_scheduler = sched;
+  else if (sched_choice_cnt < SCHED_CHOICE_CNT)
+    {
+      sched_choices[sched_choice_cnt].name = spec;
+      sched_choices[sched_choice_cnt].sched = sched;
+      sched_choice_cnt++;
+    }
+  else
+    PANIC ("too many -iosched options");
+}
+
+/* Returns the I/O scheduler configured for the block device
+   named NAME. */
+static const struct block_scheduler *
+scheduler_for (const char *name)
+{
+  size_t i;
+
+  for (i = 0; i < sched_choice_cnt; i++)
+    if (!strcmp (name, sched_choices[i].name))
+      return sched_choices[i].sched;
+  return default_scheduler;
+}
+
+/* Panics if a -iosched option named a block device that does not
+   exist or that has no request queue of its own.  Must be called
+   once all the devices, including partitions, are registered. */
+void
+block_check_schedulers (void)
+{
+  size_t i;
+
+  for (i = 0; i < sched_choice_cnt; i++)
+    {
+      const char *name = sched_choices[i].name;
+      struct block *block = block_get_by_name (name);
+
+      if (block == NULL)
+        PANIC ("-iosched: no such block device \"%s\"", name);
+      if (block->sched == NULL)
+        PANIC ("-iosched: %s has no request queue; name its disk instead",
+               name);
+    }
+}
+
+/* Returns true if request A's first sector is less than B's. */
+static bool
+request_less (const struct list_elem *a_, const struct list_elem *b_,
+              void *aux UNUSED)
+{
+  const struct block_request *a
+    = list_entry (a_, struct block_request, sort_elem);
+  const struct block_request *b
+    = list_entry (b_, struct block_request, sort_elem);
+
+  return a->dev_sector < b->dev_sector;
+}
+
+/* Initializes R as a request to transfer CNT sectors, at most
+   BLOCK_BATCH_SECTORS, starting at SECTOR between BLOCK and
+   BUFFER: writing them if WRITE is true, reading them otherwise.
+   The request has no callback, so its submitter must wait for it
+   with block_wait(); set R's CALLBACK and AUX members before
+   submitting it to be called back instead. */
+void
+block_request_init (struct block_request *r, struct block *block,
+                    block_sector_t sector, size_t cnt, void *buffer,
+                    bool write)
+{
+  ASSERT (cnt > 0 && cnt <= BLOCK_BATCH_SECTORS);
+
+  r->block = block;
+  r->sector = sector;
+  r->cnt = cnt;
+  r->buffer = buffer;
+  r->write = write;
+  r->callback = NULL;
+  r->aux = NULL;
+  sema_init (&r->done, 0);
+}
+
+/* Starts request R and returns, usually before it completes.
+   Requests for the same device may complete in any order, so a
+   submitter must not have a read and a write of the same sector
+   outstanding at once.  R's memory and buffer must remain valid
+   until it completes. */
+void
+block_submit (struct block_request *r)
+{
+  struct block *dev = r->block;
+  block_sector_t sector = r->sector;
+  uint8_t *p = r->buffer;
+  size_t i;
+
+  check_sectors (dev, sector, r->cnt);
+  ASSERT (!r->write || dev->type != BLOCK_FOREIGN);
+
+  /* Find the device that does the transfer, counting it against
+     each device on the way. */
+  for (;;)
+    {
+      if (r->write)
+        dev->write_cnt += r->cnt;
+      else
+        dev->read_cnt += r->cnt;
+      if (dev->ops->lower == NULL)
+        break;
+      dev = dev->ops->lower (dev->aux, &sector);
+    }
+  r->dev = dev;
+  r->dev_sector = sector;
+  r->submit_time = timer_cycles ();
+
+  if (dev->ops->kick != NULL)
+    {
+      r->deadline = timer_ticks () + (r->write ? WRITE_EXPIRE : READ_EXPIRE);
+      lock_acquire (&dev->queue_lock);
+      list_push_back (&dev->fifo, &r->elem);
+      list_insert_ordered (&dev->sorted, &r->sort_elem, request_less, NULL);
+      lock_release (&dev->queue_lock);
+      dev->ops->kick (dev->aux);
+      return;
+    }
+
+  /* The driver does not queue requests, so do the transfer now. */
+  if (r->write && dev->ops->write_multiple != NULL)
+    dev->ops->write_multiple (dev->aux, sector, r->cnt, p);
+  else if (!r->write && dev->ops->read_multiple != NULL)
+    dev->ops->read_multiple (dev->aux, sector, r->cnt, p);
+  else
+    for (i = 0; i < r->cnt; i++, p += BLOCK_SECTOR_SIZE)
+      {
+        if (r->write)
+          dev->ops->write (dev->aux, sector + i, p);
+        else
+          dev->ops->read (dev->aux, sector + i, p);
+      }
+  block_complete (r);
+}
+
+/* Waits for request R, which must not have a callback, to
+   complete. */
+void
+block_wait (struct block_request *r)
+{
+  ASSERT (r->callback == NULL);
+  sema_down (&r->done);
+}
+
+/* Noop scheduler: dispatches requests in arrival order. */
+static struct block_request *
+noop_choose (struct block *block)
+{
+  return list_entry (list_front (&block->fifo), struct block_request, elem);
+}
+
+/* C-LOOK elevator: sweeps the head upward through the queued
+   requests in sector order, then jumps back to the lowest one
+   and sweeps up again. */
+static struct block_request *
+clook_choose (struct block *block)
+{
+  struct list_elem *e;
+
+  for (e = list_begin (&block->sorted); e != list_end (&block->sorted);
+       e = list_next (e))
+    {
+      struct block_request *r
+        = list_entry (e, struct block_request, sort_elem);
+      if (r->dev_sector >= block->head)
+        return r;
+    }
+  return list_entry (list_front (&block->sorted),
+                     struct block_request, sort_elem);
+}
+
+/* Deadline scheduler: follows the C-LOOK order, except that the
+   oldest read or write whose deadline has passed goes first, so
+   that requests far from the head are not starved. */
+static struct block_request *
+deadline_choose (struct block *block)
+{
+  struct block_request *oldest_read = NULL, *oldest_write = NULL;
+  struct block_request *r;
+  struct list_elem *e;
+
+  for (e = list_begin (&block->fifo); e != list_end (&block->fifo);
+       e = list_next (e))
+    {
+      r = list_entry (e, struct block_request, elem);
+      if (r->write && oldest_write == NULL)
+        oldest_write = r;
+      else if (!r->write && oldest_read == NULL)
+        oldest_read = r;
+      if (oldest_read != NULL && oldest_write != NULL)
+        break;
+    }
+
+  r = oldest_read;
+  if (r == NULL
+      || (oldest_write != NULL && oldest_write->deadline < r->deadline))
+    r = oldest_write;
+  return r->deadline <= timer_ticks () ? r : clook_choose (block);
+}
+
+/* Returns true if request R can be added to a batch of CNT
+   sectors in the direction given by WRITE. */
+static bool
+can_merge (const struct block_request *r, bool write, size_t cnt)
+{
+  return r->write == write && cnt + r->cnt <= BLOCK_BATCH_SECTORS;
+}
+
+/* Removes the next batch of requests from BLOCK's queue, as
+   chosen by its I/O scheduler, and adds them to BATCH in sector
+   order.  A batch consists of the chosen request plus queued
+   requests for the sectors just before and after it, in the same
+   direction, up to BLOCK_BATCH_SECTORS sectors and
+   BLOCK_BATCH_REQUESTS requests in all.  Returns the number of
+   sectors in the batch, or 0 if the queue is empty. */
+size_t
+block_next_batch (struct block *block, struct list *batch)
+{
+  struct block_request *r, *first, *last;
+  size_t cnt, req_cnt;
+  struct list_elem *e;
+  int dir;
+
+  ASSERT (block->ops->kick != NULL);
+
+  lock_acquire (&block->queue_lock);
+  if (list_empty (&block->fifo))
+    {
+      lock_release (&block->queue_lock);
+      return 0;
+    }
+
+  /* Adjacent requests are neighbors in the sorted queue. */
+  r = first = last = block->sched->choose (block);
+  cnt = r->cnt;
+  req_cnt = 1;
+  while (req_cnt < BLOCK_BATCH_REQUESTS
+         && list_prev (&first->sort_elem) != list_rend (&block->sorted))
+    {
+      struct block_request *prev = list_entry (list_prev (&first->sort_elem),
+                                               struct block_request,
+                                               sort_elem);
+      if (prev->dev_sector + prev->cnt != first->dev_sector
+          || !can_merge (prev, r->write, cnt))
+        break;
+      first = prev;
+      cnt += prev->cnt;
+      req_cnt++;
+    }
+  while (req_cnt < BLOCK_BATCH_REQUESTS
+         && list_next (&last->sort_elem) != list_end (&block->sorted))
+    {
+      struct block_request *next = list_entry (list_next (&last->sort_elem),
+                                               struct block_request,
+                                               sort_elem);
+      if (last->dev_sector + last->cnt != next->dev_sector
+          || !can_merge (next, r->write, cnt))
+        break;
+      last = next;
+      cnt += next->cnt;
+      req_cnt++;
+    }
+
+  /* Move the batch out of the queue. */
+  e = &first->sort_elem;
+  for (;;)
+    {
+      struct block_request *q = list_entry (e, struct block_request,
+                                            sort_elem);
+      e = list_remove (e);
+      list_remove (&q->elem);
+      list_push_back (batch, &q->elem);
+      if (q == last)
+        break;
+    }
+
+  /* Account for the head movement. */
+  if (first->dev_sector != block->head)
+    {
+      dir = first->dev_sector > block->head ? 1 : -1;
+      if (block->head_dir != 0 && dir != block->head_dir)
+        block->reversal_cnt++;
+      block->head_dir = dir;
+    }
+  block->head = first->dev_sector + cnt;
+  block->batch_cnt++;
+  block->merge_cnt += req_cnt - 1;
+  lock_release (&block->queue_lock);
+
+  return cnt;
+}
+
+/* Adds a request of SIZE bytes that took CYCLES to serve to
+   STATS. */
+static void
+record_request (struct block_io_stats *stats, size_t size, uint64_t cycles)
+{
+  int bucket = 0;
+  enum intr_level old_level;
+
+  while (bucket < BLOCK_LATENCY_BUCKETS - 1 && cycles >> (bucket + 1) != 0)
+    bucket++;
+
+  /* Requests complete in more than one thread at a time. */
+  old_level = intr_disable ();
+  stats->requests++;
+  stats->bytes += size;
+  stats->total_cycles += cycles;
+  if (cycles > stats->max_cycles)
+    stats->max_cycles = cycles;
+  stats->histogram[bucket]++;
+  intr_set_level (old_level);
+}
+
+/* Marks request R as complete, by calling its callback if it has
+   one and otherwise waking up its submitter.  Drivers call this
+   for the requests that block_next_batch() gives them. */
+void
+block_complete (struct block_request *r)
+{
+  uint64_t cycles = timer_cycles () - r->submit_time;
+  block_sector_t sector = r->sector;
+  struct block *block;
+
+  /* Charge the request to each device it passed through. */
+  for (block = r->block; ; block = block->ops->lower (block->aux, &sector))
+    {
+      record_request (r->write ? &block->write_stats : &block->read_stats,
+                      r->cnt * BLOCK_SECTOR_SIZE, cycles);
+      if (block->ops->lower == NULL)
+        break;
+    }
+
+  if (r->callback != NULL)
+    r->callback (r);
+  else
+    sema_up (&r->done);
+}
+
+/* Prints STATS, for the requests of kind WHAT, on one line, and
+   its latency histogram's nonempty buckets on the next. */
+static void
+print_io_stats (const char *what, const struct block_io_stats *stats)
+{
+  int i;
+
+  if (stats->requests == 0)
+    return;
+  printf ("  %s: %llu requests, %llu bytes, %llu cycles average, "
+          "%llu max\n", what, stats->requests, stats->bytes,
+          stats->total_cycles / stats->requests, stats->max_cycles);
+  printf ("  %s latency (log2 cycles: count):", what);
+  for (i = 0; i < BLOCK_LATENCY_BUCKETS; i++)
+    if (stats->histogram[i] != 0)
+      printf (" %d: %"PRIu32, i, stats->histogram[i]);
+  printf ("\n");
+}
+
+/* Returns true if BLOCK plays a Pintos role. */
+static bool
+has_role (const struct block *block)
+{
+  int i;
+
+  for (i = 0; i < BLOCK_ROLE_CNT; i++)
+    if (block_by_role[i] == block)
+      return true;
+  return false;
+}
+
+/* Prints statistics for each block device used for a Pintos
+   role, and for each device with a request queue.  A device's
+   latency statistics are printed only once, even if it has both. */
 void
 block_print_stats (void)
 {
+  struct list_elem *e;
   int i;
 
   for (i = 0; i < BLOCK_ROLE_CNT; i++)
@@ -174,10 +700,60 @@ block_print_stats (void)
           printf ("%s (%s): %llu reads, %llu writes\n",
                   block->name, block_type_name (block->type),
                   block->read_cnt, block->write_cnt);
+          print_io_stats ("reads", &block->read_stats);
+          print_io_stats ("writes", &block->write_stats);
+        }
+    }
+
+  for (e = list_begin (&all_blocks); e != list_end (&all_blocks);
+       e = list_next (e))
+    {
+      struct block *block = list_entry (e, struct block, list_elem);
+      if (block->sched != NULL)
+        {
+          printf ("%s (%s scheduler): %llu batches, %llu merged requests, "
+                  "%llu head reversals\n",
+                  block->name, block->sched->name, block->batch_cnt,
+                  block->merge_cnt, block->reversal_cnt);
+          if (!has_role (block))
+            {
+              print_io_stats ("reads", &block->read_stats);
+              print_io_stats ("writes", &block->write_stats);
+            }
         }
     }
 }
 
+/* Copies the statistics of the block device named NAME, or of
+   the device playing the role named NAME (e.g. "swap"), into
+   *STATS.  Returns true if successful, false if there is no such
+   device. */
+bool
+block_get_stats (const char *name, struct block_stats *stats)
+{
+  struct block *block = block_get_by_name (name);
+  enum intr_level old_level;
+  int i;
+
+  for (i = 0; block == NULL && i < BLOCK_ROLE_CNT; i++)
+    if (!strcmp (name, block_type_name (i)))
+      block = block_by_role[i];
+  if (block == NULL)
+    return false;
+
+  strlcpy (stats->name, block->name, sizeof stats->name);
+  strlcpy (stats->role, block_type_name (block->type), sizeof stats->role);
+  for (i = 0; i < BLOCK_ROLE_CNT; i++)
+    if (block_by_role[i] == block)
+      strlcpy (stats->role, block_type_name (i), sizeof stats->role);
+
+  old_level = intr_disable ();
+  stats->reads = block->read_stats;
+  stats->writes = block->write_stats;
+  intr_set_level (old_level);
+  return true;
+}
+
 /* Registers a new block device with the given NAME.  If
    EXTRA_INFO is non-null, it is printed as part of a user
    message.  The block device's SIZE in sectors and its TYPE must
@@ -201,6 +777,20 @@ block_register (const char *name, enum block_type type,
   block->read_cnt = 0;
   block->write_cnt = 0;
 
+  ASSERT ((ops->read != NULL && ops->write != NULL)
+          || ops->kick != NULL || ops->lower != NULL);
+  block->sched = ops->kick != NULL ? scheduler_for (block->name) : NULL;
+  lock_init (&block->queue_lock, block->name);
+  list_init (&block->fifo);
+  list_init (&block->sorted);
+  block->head = 0;
+  block->head_dir = 0;
+  block->batch_cnt = 0;
+  block->merge_cnt = 0;
+  block->reversal_cnt = 0;
+  memset (&block->read_stats, 0, sizeof block->read_stats);
+  memset (&block->write_stats, 0, sizeof block->write_stats);
+
   printf ("%s: %'"PRDSNu" sectors (", block->name, block->size);
   print_human_readable_size ((uint64_t) block->size * BLOCK_SECTOR_SIZE);
   printf (")");
@@ -3,6 +3,9 @@
 
 #include <stddef.h>
 #include <inttypes.h>
+#include <block-stats.h>
+#include <list.h>
+#include "threads/synch.h"
 
 /* Size of a block device sector in bytes.
    All IDE disks use this sector size, as do most USB and SCSI
@@ -53,22 +56,94 @@ struct block *block_next (struct block *);
 block_sector_t block_size (struct block *);
 void block_read (struct block *, block_sector_t, void *);
 void block_write (struct block *, block_sector_t, const void *);
+void block_read_multiple (struct block *, block_sector_t, size_t cnt,
+                          void *);
+void block_write_multiple (struct block *, block_sector_t, size_t cnt,
+                           const void *);
 const char *block_name (struct block *);
 enum block_type block_type (struct block *);
 
+/* I/O schedulers. */
+void block_configure_scheduler (char *spec);
+void block_check_schedulers (void);
+
 /* Statistics. */
 void block_print_stats (void);
+bool block_get_stats (const char *name, struct block_stats *);
 
 /* Lower-level interface to block device drivers. */
 
+/* READ_MULTIPLE and WRITE_MULTIPLE transfer CNT consecutive
+   sectors in one request.  A driver that cannot do better than
+   one sector at a time may leave them null, and the block layer
+   will call READ or WRITE once per sector instead.
+
+   A driver that sets KICK instead of READ and WRITE has its
+   transfers queued by the block layer, whose I/O scheduler
+   decides their order.  The block layer calls KICK each time it
+   queues a request.  The driver then takes batches of requests
+   with block_next_batch() and completes each request with
+   block_complete().
+
+   A device that is a window onto another, such as a partition,
+   sets only LOWER, which translates *SECTOR into a sector on the
+   underlying device and returns that device. */
 struct block_operations
   {
     void (*read) (void *aux, block_sector_t, void *buffer);
     void (*write) (void *aux, block_sector_t, const void *buffer);
+    void (*read_multiple) (void *aux, block_sector_t, size_t cnt,
+                           void *buffer);
+    void (*write_multiple) (void *aux, block_sector_t, size_t cnt,
+                            const void *buffer);
+    void (*kick) (void *aux);
+    struct block *(*lower) (void *aux, block_sector_t *sector);
   };
 
 struct block *block_register (const char *name, enum block_type,
                               const char *extra_info, block_sector_t size,
                               const struct block_operations *, void *aux);
 
+/* Asynchronous requests. */
+
+struct block_request;
+typedef void block_callback (struct block_request *);
+
+/* A transfer between a block device and memory.  The submitter
+   sets the first group of members, with block_request_init(), and
+   the block layer owns the rest until the request completes. */
+struct block_request
+  {
+    struct block *block;        /* Device. */
+    block_sector_t sector;      /* First sector. */
+    size_t cnt;                 /* Number of sectors. */
+    void *buffer;               /* CNT * BLOCK_SECTOR_SIZE bytes. */
+    bool write;                 /* True to write, false to read. */
+    block_callback *callback;   /* Called on completion, or null. */
+    void *aux;                  /* For CALLBACK's use. */
+
+    struct block *dev;          /* Device that does the transfer. */
+    block_sector_t dev_sector;  /* First sector on DEV. */
+    int64_t deadline;           /* Tick by which to dispatch it. */
+    uint64_t submit_time;       /* CPU cycle count at submission. */
+    struct list_elem sort_elem; /* Element in queue sorted by sector. */
+    struct list_elem elem;      /* Element in arrival queue or batch. */
+    struct semaphore done;      /* Up'd on completion, if no CALLBACK. */
+  };
+
+/* Limits on the batches that block_next_batch() returns.  A
+   single request may not be larger than a batch. */
+#define BLOCK_BATCH_SECTORS 256 /* Most sectors in a batch. */
+#define BLOCK_BATCH_REQUESTS 16 /* Most requests in a batch. */
+
+void block_request_init (struct block_request *, struct block *,
+                         block_sector_t, size_t cnt, void *buffer,
+                         bool write);
+void block_submit (struct block_request *);
+void block_wait (struct block_request *);
+
+/* Interface for drivers that queue requests. */
+size_t block_next_batch (struct block *, struct list *batch);
+void block_complete (struct block_request *);
+
 #endif /* devices/block.h */
@@ -5,13 +5,28 @@
 #include <stdio.h>
 #include "devices/block.h"
 #include "devices/partition.h"
+#include "devices/pci.h"
 #include "devices/timer.h"
 #include "threads/io.h"
 #include "threads/interrupt.h"
 #include "threads/synch.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
 
 /* The code in this file is an interface to an ATA (IDE)
-   controller.  It attempts to comply to [ATA-3]. */
+   controller.  It attempts to comply to [ATA-3].
+
+   Sectors are moved by bus master DMA, as described in [BMIDE],
+   when the channel's PCI controller and the disk both support it,
+   so that the CPU is free to run other threads during a transfer.
+   Otherwise, the CPU moves them itself, in PIO mode.
+
+   The block layer queues transfers to the disks and orders them
+   with its I/O scheduler.  Each channel has a thread that takes
+   batches of adjacent requests for its disks from the block layer
+   and issues each batch as one command, so that callers sleep
+   until their transfers are done instead of holding the
+   channel. */
 
 /* ATA command block port addresses. */
 #define reg_data(CHANNEL) ((CHANNEL)->reg_base + 0)     /* Data. */
@@ -33,7 +48,9 @@
 /* Alternate Status Register bits. */
 #define STA_BSY 0x80            /* Busy. */
 #define STA_DRDY 0x40           /* Device Ready. */
+#define STA_DF 0x20             /* Device Fault. */
 #define STA_DRQ 0x08            /* Data Request. */
+#define STA_ERR 0x01            /* Error. */
 
 /* Control Register bits. */
 #define CTL_SRST 0x04           /* Software Reset. */
@@ -49,6 +66,62 @@
 #define CMD_IDENTIFY_DEVICE 0xec        /* IDENTIFY DEVICE. */
 #define CMD_READ_SECTOR_RETRY 0x20      /* READ SECTOR with retries. */
 #define CMD_WRITE_SECTOR_RETRY 0x30     /* WRITE SECTOR with retries. */
+#define CMD_READ_MULTIPLE 0xc4          /* READ MULTIPLE. */
+#define CMD_WRITE_MULTIPLE 0xc5         /* WRITE MULTIPLE. */
+#define CMD_SET_MULTIPLE_MODE 0xc6      /* SET MULTIPLE MODE. */
+#define CMD_READ_DMA 0xc8               /* READ DMA with retries. */
+#define CMD_WRITE_DMA 0xca              /* WRITE DMA with retries. */
+
+/* IDENTIFY DEVICE word whose low byte is the most sectors the
+   disk can transfer per interrupt with READ/WRITE MULTIPLE. */
+#define ID_MULTIPLE 47
+
+/* IDENTIFY DEVICE capabilities word and its bits. */
+#define ID_CAPABILITIES 49
+#define ID_CAP_DMA 0x0100       /* DMA supported. */
+
+/* Bus master IDE port addresses. */
+#define reg_bm_command(CHANNEL) ((CHANNEL)->bm_base + 0) /* Command. */
+#define reg_bm_status(CHANNEL) ((CHANNEL)->bm_base + 2)  /* Status. */
+#define reg_bm_prdt(CHANNEL) ((CHANNEL)->bm_base + 4)    /* PRD table. */
+
+/* Bus master Command Register bits. */
+#define BMC_START 0x01          /* Start transfer. */
+#define BMC_READ 0x08           /* Transfer direction: disk to memory. */
+
+/* Bus master Status Register bits. */
+#define BMS_ERROR 0x02          /* Transfer failed (write 1 to clear). */
+#define BMS_INTR 0x04           /* Disk interrupted (write 1 to clear). */
+#define BMS_DMA_CAPABLE 0x60    /* Set by firmware, must be preserved. */
+#define BMS_SIMPLEX 0x80        /* Only one channel may use DMA at once. */
+
+/* PCI class code of IDE controllers, and the programming
+   interface bits that matter to us. */
+#define PCI_CLASS_STORAGE 0x01
+#define PCI_SUBCLASS_IDE 0x01
+#define PCI_IF_NATIVE 0x05      /* Either channel in native mode. */
+#define PCI_IF_BUS_MASTER 0x80  /* Supports bus master DMA. */
+
+/* Most sectors that one read or write command can transfer.  A
+   sector count of 0 in the command means this many. */
+#define MAX_SECTORS_PER_CMD 256
+
+/* A physical region descriptor, which describes one physically
+   contiguous part of a DMA buffer to the bus master.  A region
+   may not cross a 64 kB boundary. */
+struct prd
+  {
+    uint32_t addr;              /* Physical address. */
+    uint16_t size;              /* Size in bytes, 0 meaning 64 kB. */
+    uint16_t flags;             /* PRD_EOT in the last descriptor. */
+  };
+
+#define PRD_EOT 0x8000          /* End of table. */
+
+/* Descriptors in a PRD table.  Each request in a batch needs one,
+   plus one for each 64 kB boundary that it crosses, so this is
+   enough for any batch. */
+#define PRD_CNT 64
 
 /* An ATA device. */
 struct ata_disk
@@ -57,6 +130,21 @@ struct ata_disk
     struct channel *channel;    /* Channel that disk is attached to. */
     int dev_no;                 /* Device 0 or 1 for master or slave. */
     bool is_ata;                /* Is device an ATA disk? */
+    bool use_dma;               /* Transfer sectors by DMA? */
+    size_t multiple_cnt;        /* Sectors per interrupt in PIO mode. */
+    struct block *block;        /* Block device, once registered. */
+  };
+
+/* A batch of block requests that one ATA command transfers. */
+struct ide_command
+  {
+    struct ata_disk *disk;      /* Disk. */
+    block_sector_t sector;      /* First sector. */
+    size_t cnt;                 /* Sectors, at most MAX_SECTORS_PER_CMD. */
+    bool write;                 /* True to write, false to read. */
+    bool dma;                   /* Transfer by DMA? */
+    size_t prd_cnt;             /* PRDs needed for DMA. */
+    struct list requests;       /* Block requests, in sector order. */
   };
 
 /* An ATA channel (aka controller).
@@ -67,11 +155,15 @@ struct channel
     uint16_t reg_base;          /* Base I/O port. */
     uint8_t irq;                /* Interrupt in use. */
 
-    struct lock lock;           /* Must acquire to access the controller. */
+    struct semaphore kicked;    /* Up'd when a request is queued. */
+    int next_dev;               /* Device to take requests from first. */
     bool expecting_interrupt;   /* True if an interrupt is expected, false if
                                    any interrupt would be spurious. */
     struct semaphore completion_wait;   /* Up'd by interrupt handler. */
 
+    uint16_t bm_base;           /* Bus master base port, 0 if none. */
+    struct prd *prdt;           /* PRD table for DMA transfers. */
+
     struct ata_disk devices[2];     /* The devices on this channel. */
   };
 
@@ -79,16 +171,30 @@ struct channel
 #define CHANNEL_CNT 2
 static struct channel channels[CHANNEL_CNT];
 
+/* One PRD table per channel.  Aligning a table to its own size
+   keeps it from crossing a 64 kB boundary, as the bus master
+   requires. */
+static struct prd prd_tables[CHANNEL_CNT][PRD_CNT]
+  __attribute__ ((aligned (sizeof (struct prd) * PRD_CNT)));
+
 static struct block_operations ide_operations;
 
+static uint16_t find_bus_master (void);
 static void reset_channel (struct channel *);
 static bool check_device_type (struct ata_disk *);
 static void identify_ata_device (struct ata_disk *);
 
-static void select_sector (struct ata_disk *, block_sector_t);
-static void issue_pio_command (struct channel *, uint8_t command);
+static void select_sector (struct ata_disk *, block_sector_t, size_t cnt);
+static void issue_command (struct channel *, uint8_t command);
+static size_t set_multiple_mode (struct ata_disk *, size_t cnt);
+
+static void channel_thread (void *);
+static bool next_command (struct channel *, struct ide_command *);
+static void pio_transfer (struct ide_command *);
 static void input_sector (struct channel *, void *);
 static void output_sector (struct channel *, const void *);
+static size_t prds_needed (const void *, size_t size);
+static void dma_transfer (struct ide_command *);
 
 static void wait_until_idle (const struct ata_disk *);
 static bool wait_while_busy (const struct ata_disk *);
@@ -101,6 +207,7 @@ static void interrupt_handler (struct intr_frame *);
 void
 ide_init (void) 
 {
+  uint16_t bm_base = find_bus_master ();
   size_t chan_no;
 
   for (chan_no = 0; chan_no < CHANNEL_CNT; chan_no++)
@@ -123,9 +230,19 @@ ide_init (void)
         default:
           NOT_REACHED ();
         }
-      lock_init (&c->lock);
+      sema_init (&c->kicked, 0);
+      c->next_dev = 0;
       c->expecting_interrupt = false;
       sema_init (&c->completion_wait, 0);
+
+      /* Each channel has its own 8 bus master ports.  A simplex
+         controller can only do DMA on one channel at a time, so
+         leave the second one to PIO. */
+      c->bm_base = bm_base != 0 ? bm_base + 8 * chan_no : 0;
+      if (c->bm_base != 0 && chan_no > 0
+          && (inb (reg_bm_status (&channels[0])) & BMS_SIMPLEX))
+        c->bm_base = 0;
+      c->prdt = prd_tables[chan_no];
  
       /* Initialize devices. */
       for (dev_no = 0; dev_no < 2; dev_no++)
@@ -136,6 +253,9 @@ ide_init (void)
           d->channel = c;
           d->dev_no = dev_no;
           d->is_ata = false;
+          d->use_dma = false;
+          d->multiple_cnt = 1;
+          d->block = NULL;
         }
 
       /* Register interrupt handler. */
@@ -148,6 +268,13 @@ ide_init (void)
       if (check_device_type (&c->devices[0]))
         check_device_type (&c->devices[1]);
 
+      /* Start the thread that issues queued requests.  Until a
+         disk is registered nothing can be queued for it, and the
+         partition scan that follows registering waits for its
+         reads, so identifying the next disk does not race with
+         the thread. */
+      thread_create (c->name, PRI_MAX, channel_thread, c);
+
       /* Read hard disk identity information. */
       for (dev_no = 0; dev_no < 2; dev_no++)
         if (c->devices[dev_no].is_ata)
@@ -159,6 +286,40 @@ ide_init (void)
 
 static char *descramble_ata_string (char *, int size);
 
+/* Looks for a PCI IDE controller that drives the legacy channels
+   and can act as a bus master.  If one is found, enables its bus
+   mastering and returns the base port of its bus master
+   registers.  Otherwise, returns 0, and all transfers use PIO. */
+static uint16_t
+find_bus_master (void)
+{
+  struct pci_function f;
+  uint8_t prog_if;
+  uint32_t bar, command;
+
+  if (!pci_find_class (PCI_CLASS_STORAGE, PCI_SUBCLASS_IDE, &f))
+    return 0;
+
+  /* A controller in native mode does not live at the legacy
+     ports that we drive. */
+  prog_if = pci_read_config (&f, PCI_REG_CLASS) >> 8;
+  if ((prog_if & PCI_IF_BUS_MASTER) == 0 || (prog_if & PCI_IF_NATIVE) != 0)
+    return 0;
+
+  /* The bus master registers are in I/O space, at BAR 4. */
+  bar = pci_read_config (&f, PCI_REG_BAR (4));
+  if ((bar & 1) == 0 || (bar & 0xfffc) == 0)
+    return 0;
+
+  /* Only the low half of the command register is written, since
+     writing ones to the status half would clear its bits. */
+  command = pci_read_config (&f, PCI_REG_COMMAND) & 0xffff;
+  pci_write_config (&f, PCI_REG_COMMAND,
+                    command | PCI_CMD_IO | PCI_CMD_MASTER);
+
+  return bar & 0xfffc;
+}
+
 /* Resets an ATA channel and waits for any devices present on it
    to finish the reset. */
 static void
@@ -272,7 +433,7 @@ identify_ata_device (struct ata_disk *d)
      indicating the device's response is ready, and read the data
      into our buffer. */
   select_device_wait (d);
-  issue_pio_command (c, CMD_IDENTIFY_DEVICE);
+  issue_command (c, CMD_IDENTIFY_DEVICE);
   sema_down (&c->completion_wait);
   if (!wait_while_busy (d))
     {
@@ -288,6 +449,9 @@ identify_ata_device (struct ata_disk *d)
   serial = descramble_ata_string (&id[27 * 2], 40);
   snprintf (extra_info, sizeof extra_info,
             "model \"%s\", serial \"%s\"", model, serial);
+  d->use_dma = (c->bm_base != 0
+                && (*(uint16_t *) &id[ID_CAPABILITIES * 2] & ID_CAP_DMA));
+  d->multiple_cnt = set_multiple_mode (d, (uint8_t) id[ID_MULTIPLE * 2]);
 
   /* Disable access to IDE disks over 1 GB, which are likely
      physical IDE disks rather than virtual ones.  If we don't
@@ -306,6 +470,7 @@ identify_ata_device (struct ata_disk *d)
   /* Register. */
   block = block_register (d->name, BLOCK_RAW, extra_info, capacity,
                           &ide_operations, d);
+  d->block = block;
   partition_scan (block);
 }
 
@@ -337,63 +502,39 @@ descramble_ata_string (char *string, int size)
   return string;
 }
 
-/* Reads sector SEC_NO from disk D into BUFFER, which must have
-   room for BLOCK_SECTOR_SIZE bytes.
-   Internally synchronizes accesses to disks, so external
-   per-disk locking is unneeded. */
+/* Wakes up the thread for disk D_'s channel, because the block
+   layer has queued a request for D_. */
 static void
-ide_read (void *d_, block_sector_t sec_no, void *buffer)
+ide_kick (void *d_)
 {
   struct ata_disk *d = d_;
-  struct channel *c = d->channel;
-  lock_acquire (&c->lock);
-  select_sector (d, sec_no);
-  issue_pio_command (c, CMD_READ_SECTOR_RETRY);
-  sema_down (&c->completion_wait);
-  if (!wait_while_busy (d))
-    PANIC ("%s: disk read failed, sector=%"PRDSNu, d->name, sec_no);
-  input_sector (c, buffer);
-  lock_release (&c->lock);
-}
 
-/* Write sector SEC_NO to disk D from BUFFER, which must contain
-   BLOCK_SECTOR_SIZE bytes.  Returns after the disk has
-   acknowledged receiving the data.
-   Internally synchronizes accesses to disks, so external
-   per-disk locking is unneeded. */
-static void
-ide_write (void *d_, block_sector_t sec_no, const void *buffer)
-{
-  struct ata_disk *d = d_;
-  struct channel *c = d->channel;
-  lock_acquire (&c->lock);
-  select_sector (d, sec_no);
-  issue_pio_command (c, CMD_WRITE_SECTOR_RETRY);
-  if (!wait_while_busy (d))
-    PANIC ("%s: disk write failed, sector=%"PRDSNu, d->name, sec_no);
-  output_sector (c, buffer);
-  sema_down (&c->completion_wait);
-  lock_release (&c->lock);
+  sema_up (&d->channel->kicked);
 }
 
 static struct block_operations ide_operations =
   {
-    ide_read,
-    ide_write
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    ide_kick,
+    NULL
   };
-
+
 /* Selects device D, waiting for it to become ready, and then
-   writes SEC_NO to the disk's sector selection registers.  (We
-   use LBA mode.) */
+   writes SEC_NO and CNT to the disk's sector selection and
+   sector count registers.  (We use LBA mode.) */
 static void
-select_sector (struct ata_disk *d, block_sector_t sec_no)
+select_sector (struct ata_disk *d, block_sector_t sec_no, size_t cnt)
 {
   struct channel *c = d->channel;
 
   ASSERT (sec_no < (1UL << 28));
+  ASSERT (cnt > 0 && cnt <= MAX_SECTORS_PER_CMD);
   
   select_device_wait (d);
-  outb (reg_nsect (c), 1);
+  outb (reg_nsect (c), cnt == MAX_SECTORS_PER_CMD ? 0 : cnt);
   outb (reg_lbal (c), sec_no);
   outb (reg_lbam (c), sec_no >> 8);
   outb (reg_lbah (c), (sec_no >> 16));
@@ -404,7 +545,7 @@ select_sector (struct ata_disk *d, block_sector_t sec_no)
 /* Writes COMMAND to channel C and prepares for receiving a
    completion interrupt. */
 static void
-issue_pio_command (struct channel *c, uint8_t command) 
+issue_command (struct channel *c, uint8_t command) 
 {
   /* Interrupts must be enabled or our semaphore will never be
      up'd by the completion handler. */
@@ -414,6 +555,164 @@ issue_pio_command (struct channel *c, uint8_t command)
   outb (reg_command (c), command);
 }
 
+/* Sets disk D to transfer up to CNT sectors per interrupt with
+   READ/WRITE MULTIPLE, and returns the number of sectors per
+   interrupt in effect afterward. */
+static size_t
+set_multiple_mode (struct ata_disk *d, size_t cnt)
+{
+  struct channel *c = d->channel;
+
+  if (cnt <= 1)
+    return 1;
+
+  select_device_wait (d);
+  outb (reg_nsect (c), cnt);
+  issue_command (c, CMD_SET_MULTIPLE_MODE);
+  sema_down (&c->completion_wait);
+  wait_while_busy (d);
+  return (inb (reg_alt_status (c)) & STA_ERR) == 0 ? cnt : 1;
+}
+
+/* Request queue. */
+
+/* Thread that issues the requests queued for channel C_'s
+   disks, one batch at a time, and completes them. */
+static void
+channel_thread (void *c_)
+{
+  struct channel *c = c_;
+
+  for (;;)
+    {
+      struct ide_command cmd;
+      struct list_elem *e;
+
+      if (!next_command (c, &cmd))
+        {
+          sema_down (&c->kicked);
+          continue;
+        }
+
+      if (cmd.dma)
+        dma_transfer (&cmd);
+      else
+        pio_transfer (&cmd);
+
+      for (e = list_begin (&cmd.requests); e != list_end (&cmd.requests); )
+        {
+          struct block_request *r = list_entry (e, struct block_request,
+                                                elem);
+          e = list_next (e);
+          block_complete (r);
+        }
+    }
+}
+
+/* Takes the next batch of requests for one of channel C's disks
+   from the block layer and stores it in CMD.  The disks take
+   turns, so that one busy disk cannot starve the other.  Returns
+   false if no requests are queued for either disk. */
+static bool
+next_command (struct channel *c, struct ide_command *cmd)
+{
+  struct list_elem *e;
+  int i;
+
+  list_init (&cmd->requests);
+  for (i = 0; i < 2; i++)
+    {
+      struct ata_disk *d = &c->devices[(c->next_dev + i) % 2];
+      struct block_request *r;
+
+      if (d->block == NULL)
+        continue;
+      cmd->cnt = block_next_batch (d->block, &cmd->requests);
+      if (cmd->cnt == 0)
+        continue;
+
+      r = list_entry (list_front (&cmd->requests),
+                      struct block_request, elem);
+      cmd->disk = d;
+      cmd->sector = r->dev_sector;
+      cmd->write = r->write;
+      cmd->dma = d->use_dma;
+      cmd->prd_cnt = 0;
+      for (e = list_begin (&cmd->requests); e != list_end (&cmd->requests);
+           e = list_next (e))
+        {
+          size_t prd_cnt;
+
+          r = list_entry (e, struct block_request, elem);
+          prd_cnt = prds_needed (r->buffer, r->cnt * BLOCK_SECTOR_SIZE);
+          if (prd_cnt == 0)
+            cmd->dma = false;
+          cmd->prd_cnt += prd_cnt;
+        }
+      if (cmd->prd_cnt > PRD_CNT)
+        cmd->dma = false;
+
+      c->next_dev = (d->dev_no + 1) % 2;
+      return true;
+    }
+  return false;
+}
+
+/* Transfers CMD in PIO mode.  The disk interrupts once per block
+   of up to multiple_cnt sectors, and the CPU copies each sector
+   through the data register. */
+static void
+pio_transfer (struct ide_command *cmd)
+{
+  struct ata_disk *d = cmd->disk;
+  struct channel *c = d->channel;
+  struct list_elem *e = list_begin (&cmd->requests);
+  size_t ofs = 0;
+  size_t done = 0;
+
+  select_sector (d, cmd->sector, cmd->cnt);
+  if (d->multiple_cnt > 1)
+    issue_command (c, cmd->write ? CMD_WRITE_MULTIPLE : CMD_READ_MULTIPLE);
+  else
+    issue_command (c, cmd->write ? CMD_WRITE_SECTOR_RETRY
+                                 : CMD_READ_SECTOR_RETRY);
+  while (done < cmd->cnt)
+    {
+      size_t block = cmd->cnt - done;
+      size_t i;
+
+      if (block > d->multiple_cnt)
+        block = d->multiple_cnt;
+
+      /* A read interrupts when a block is ready.  A write
+         interrupts when the disk has taken one. */
+      if (!cmd->write)
+        sema_down (&c->completion_wait);
+      if (!wait_while_busy (d))
+        PANIC ("%s: disk %s failed, sector=%"PRDSNu,
+               d->name, cmd->write ? "write" : "read", cmd->sector + done);
+      for (i = 0; i < block; i++)
+        {
+          struct block_request *r = list_entry (e, struct block_request,
+                                                elem);
+          uint8_t *p = (uint8_t *) r->buffer + ofs * BLOCK_SECTOR_SIZE;
+
+          if (cmd->write)
+            output_sector (c, p);
+          else
+            input_sector (c, p);
+          if (++ofs == r->cnt)
+            {
+              e = list_next (e);
+              ofs = 0;
+            }
+        }
+      if (cmd->write)
+        sema_down (&c->completion_wait);
+      done += block;
+    }
+}
+
 /* Reads a sector from channel C's data register in PIO mode into
    SECTOR, which must have room for BLOCK_SECTOR_SIZE bytes. */
 static void
@@ -430,6 +729,97 @@ output_sector (struct channel *c, const void *sector)
   outsw (reg_data (c), sector, BLOCK_SECTOR_SIZE / 2);
 }
 
+/* Returns the number of PRDs needed to describe the SIZE bytes
+   at BUFFER, or 0 if BUFFER cannot be transferred by DMA, because
+   it is not in the kernel's linear mapping of physical memory or
+   is not aligned on a word boundary.  Kernel virtual memory maps
+   physical memory linearly, so the buffer is physically
+   contiguous and only needs to be split at 64 kB boundaries. */
+static size_t
+prds_needed (const void *buffer, size_t size)
+{
+  uint32_t addr;
+
+  if (!is_kernel_vaddr (buffer) || (uintptr_t) buffer % 2 != 0)
+    return 0;
+  addr = vtop (buffer);
+  return ((addr + size - 1) >> 16) - (addr >> 16) + 1;
+}
+
+/* Fills in channel C's PRD table to describe the buffers of
+   CMD's requests, in order. */
+static void
+build_prdt (struct channel *c, struct ide_command *cmd)
+{
+  struct list_elem *e;
+  size_t i = 0;
+
+  for (e = list_begin (&cmd->requests); e != list_end (&cmd->requests);
+       e = list_next (e))
+    {
+      struct block_request *r = list_entry (e, struct block_request, elem);
+      uint32_t addr = vtop (r->buffer);
+      size_t size = r->cnt * BLOCK_SECTOR_SIZE;
+
+      while (size > 0)
+        {
+          uint32_t chunk = 0x10000 - (addr & 0xffff);
+          if (chunk > size)
+            chunk = size;
+
+          ASSERT (i < PRD_CNT);
+          c->prdt[i].addr = addr;
+          c->prdt[i].size = chunk;
+          c->prdt[i].flags = 0;
+          addr += chunk;
+          size -= chunk;
+          i++;
+        }
+    }
+  ASSERT (i == cmd->prd_cnt);
+  c->prdt[i - 1].flags = PRD_EOT;
+}
+
+/* Transfers CMD by bus master DMA.  The disk interrupts once,
+   when the whole transfer is done, and the calling thread sleeps
+   until then. */
+static void
+dma_transfer (struct ide_command *cmd)
+{
+  struct ata_disk *d = cmd->disk;
+  struct channel *c = d->channel;
+  uint8_t direction = cmd->write ? 0 : BMC_READ;
+  uint8_t bm_status;
+
+  ASSERT (c->bm_base != 0);
+
+  /* Point the bus master at the PRD table, set the direction,
+     and clear the error and interrupt bits left over from the
+     last transfer. */
+  build_prdt (c, cmd);
+  outl (reg_bm_prdt (c), vtop (c->prdt));
+  outb (reg_bm_command (c), direction);
+  outb (reg_bm_status (c), (inb (reg_bm_status (c)) & BMS_DMA_CAPABLE)
+                           | BMS_ERROR | BMS_INTR);
+
+  /* Issue the command, then start the bus master. */
+  select_sector (d, cmd->sector, cmd->cnt);
+  issue_command (c, cmd->write ? CMD_WRITE_DMA : CMD_READ_DMA);
+  outb (reg_bm_command (c), direction | BMC_START);
+
+  sema_down (&c->completion_wait);
+
+  /* Stop the bus master and check how the transfer went. */
+  outb (reg_bm_command (c), direction);
+  bm_status = inb (reg_bm_status (c));
+  outb (reg_bm_status (c), (bm_status & BMS_DMA_CAPABLE)
+                           | BMS_ERROR | BMS_INTR);
+  if ((bm_status & BMS_ERROR) != 0
+      || (inb (reg_alt_status (c)) & (STA_ERR | STA_DF)) != 0)
+    PANIC ("%s: disk %s failed, sector=%"PRDSNu,
+           d->name, cmd->write ? "write" : "read", cmd->sector);
+}
+
 /* Low-level ATA primitives. */
 
 /* Wait up to 10 seconds for the controller to become idle, that
@@ -0,0 +1,83 @@
+#include "devices/pci.h"
+#include <debug.h>
+#include "threads/io.h"
+
+/* Access to PCI configuration space, using configuration
+   mechanism #1 as described in [PCI] section 3.2.2.3.2.  This is
+   only as much of PCI as the drivers need to find and set up
+   their controllers. */
+
+/* Configuration mechanism #1 ports. */
+#define PCI_CONFIG_ADDRESS 0xcf8
+#define PCI_CONFIG_DATA 0xcfc
+
+/* Vendor ID that reads back when no function is present. */
+#define PCI_NO_VENDOR 0xffff
+
+/* Header type bit that marks a multi-function device. */
+#define PCI_HEADER_MULTI 0x80
+
+/* Selects register REG of function F for the next access to
+   PCI_CONFIG_DATA. */
+static void
+select_register (const struct pci_function *f, uint8_t reg)
+{
+  ASSERT (f->dev < 32 && f->func < 8);
+  ASSERT (reg % 4 == 0);
+
+  outl (PCI_CONFIG_ADDRESS, (1u << 31) | (f->bus << 16) | (f->dev << 11)
+                            | (f->func << 8) | reg);
+}
+
+/* Returns the 32-bit configuration register REG of function F. */
+uint32_t
+pci_read_config (const struct pci_function *f, uint8_t reg)
+{
+  select_register (f, reg);
+  return inl (PCI_CONFIG_DATA);
+}
+
+/* Sets the 32-bit configuration register REG of function F to
+   VALUE. */
+void
+pci_write_config (const struct pci_function *f, uint8_t reg, uint32_t value)
+{
+  select_register (f, reg);
+  outl (PCI_CONFIG_DATA, value);
+}
+
+/* Searches every bus for the first function with the given CLASS
+   and SUBCLASS codes.  If one is found, stores its location in
+   *F and returns true.  Otherwise, returns false. */
+bool
+pci_find_class (uint8_t class, uint8_t subclass, struct pci_function *f)
+{
+  unsigned bus, dev, func;
+
+  for (bus = 0; bus < 256; bus++)
+    for (dev = 0; dev < 32; dev++)
+      {
+        unsigned func_cnt = 1;
+
+        for (func = 0; func < func_cnt; func++)
+          {
+            uint32_t class_reg;
+
+            f->bus = bus;
+            f->dev = dev;
+            f->func = func;
+            if ((pci_read_config (f, PCI_REG_ID) & 0xffff) == PCI_NO_VENDOR)
+              continue;
+            if (func == 0
+                && (pci_read_config (f, PCI_REG_HEADER) >> 16)
+                   & PCI_HEADER_MULTI)
+              func_cnt = 8;
+
+            class_reg = pci_read_config (f, PCI_REG_CLASS);
+            if ((class_reg >> 24) == class
+                && ((class_reg >> 16) & 0xff) == subclass)
+              return true;
+          }
+      }
+  return false;
+}
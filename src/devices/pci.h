@@ -0,0 +1,31 @@
+#ifndef DEVICES_PCI_H
+#define DEVICES_PCI_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* A PCI function, identified by its place on the bus. */
+struct pci_function
+  {
+    uint8_t bus;                /* Bus number. */
+    uint8_t dev;                /* Device number on the bus, 0...31. */
+    uint8_t func;               /* Function number, 0...7. */
+  };
+
+/* Configuration space registers. */
+#define PCI_REG_ID 0x00         /* Vendor ID (low), device ID (high). */
+#define PCI_REG_COMMAND 0x04    /* Command (low), status (high). */
+#define PCI_REG_CLASS 0x08      /* Revision, prog IF, subclass, class. */
+#define PCI_REG_HEADER 0x0c     /* Header type in bits 16...23. */
+#define PCI_REG_BAR(N) (0x10 + 4 * (N))  /* Base address register N. */
+
+/* Command register bits. */
+#define PCI_CMD_IO 0x0001       /* Respond to I/O space accesses. */
+#define PCI_CMD_MASTER 0x0004   /* May act as a bus master. */
+
+bool pci_find_class (uint8_t class, uint8_t subclass, struct pci_function *);
+uint32_t pci_read_config (const struct pci_function *, uint8_t reg);
+void pci_write_config (const struct pci_function *, uint8_t reg,
+                       uint32_t value);
+
+#endif /* devices/pci.h */
@@ -20,21 +20,49 @@
 /* Number of timer ticks since OS booted. */
 static int64_t ticks;
 
+/* PIT cycles per timer tick, as programmed by timer_init(). */
+#define PIT_TICK_COUNT ((PIT_HZ + TIMER_FREQ / 2) / TIMER_FREQ)
+
+/* Longest one-shot countdown the 16-bit PIT counter can hold,
+   in timer ticks (5 at TIMER_FREQ == 100). */
+#define ONESHOT_MAX_TICKS (65536 / PIT_TICK_COUNT)
+
+/* If true, the periodic timer interrupt is stopped while the
+   idle thread runs.  Controlled by kernel command-line option
+   "-tickless". */
+bool timer_tickless;
+
+/* Number of ticks covered by the one-shot countdown armed by
+   timer_idle_enter(), or 0 if the PIT is in periodic mode. */
+static int64_t oneshot_ticks;
+
 /* Number of loops per timer tick.
    Initialized by timer_calibrate(). */
 static unsigned loops_per_tick;
 
+/* Threads blocked in timer_sleep(), kept in a pairing heap
+   ordered by wakeup tick, so that the timer interrupt only has
+   to look at the root to find the threads that are due.  The
+   heap is threaded through the sleep_child and sleep_sibling
+   members of struct thread, so no memory is allocated.
+   Accessed only with interrupts off. */
+static struct thread *sleep_heap;
+
 static intr_handler_func timer_interrupt;
 static bool too_many_loops (unsigned loops);
 static void busy_wait (int64_t loops);
 static void real_time_sleep (int64_t num, int32_t denom);
 static void real_time_delay (int64_t num, int32_t denom);
+static struct thread *sleep_meld (struct thread *, struct thread *);
+static struct thread *sleep_merge_pairs (struct thread *);
+static void wake_sleepers (void);
 
 /* Sets up the timer to interrupt TIMER_FREQ times per second,
    and registers the corresponding interrupt. */
 void
 timer_init (void) 
 {
+  oneshot_ticks = 0;
   pit_configure_channel (0, 2, TIMER_FREQ);
   intr_register_ext (0x20, timer_interrupt, "8254 Timer");
 }
@@ -84,19 +112,35 @@ timer_elapsed (int64_t then)
   return timer_ticks () - then;
 }
 
+/* Returns the CPU's time-stamp counter, which counts clock
+   cycles, for timing intervals much shorter than a tick. */
+uint64_t
+timer_cycles (void)
+{
+  uint64_t tsc;
+
+  asm volatile ("rdtsc" : "=A" (tsc));
+  return tsc;
+}
+
 /* Sleeps for approximately TICKS timer ticks.  Interrupts must
    be turned on. */
 void
 timer_sleep (int64_t ticks) 
 {
+  struct thread *t = thread_current ();
 
   ASSERT (intr_get_level () == INTR_ON);
 
-  intr_disable();
-  struct thread *t = thread_current();
-  t->ticks = ticks + timer_ticks();
-  thread_block();
-  intr_enable();
+  if (ticks <= 0)
+    return;
+
+  intr_disable ();
+  t->ticks = ticks + timer_ticks ();
+  t->sleep_child = t->sleep_sibling = NULL;
+  sleep_heap = sleep_meld (sleep_heap, t);
+  thread_block ();
+  intr_enable ();
 }
 
 /* Sleeps for approximately MS milliseconds.  Interrupts must be
@@ -169,14 +213,152 @@ timer_print_stats (void)
   printf ("Timer: %"PRId64" ticks\n", timer_ticks ());
 }
 
+/* Called by the idle thread, with interrupts off, just before
+   it halts the CPU.  In tickless mode, replaces the periodic
+   timer interrupt by a single interrupt at the next sleeper's
+   wakeup tick, so that an idle CPU is not woken up every tick.
+   The countdown is limited by the width of the PIT counter and
+   never runs past the next whole second, so that the
+   once-per-second work in thread_tick() still happens on time. */
+void
+timer_idle_enter (void)
+{
+  int64_t cnt;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  if (!timer_tickless || oneshot_ticks != 0)
+    return;
+
+  cnt = TIMER_FREQ - ticks % TIMER_FREQ;
+  if (sleep_heap != NULL && sleep_heap->ticks - ticks < cnt)
+    cnt = sleep_heap->ticks - ticks;
+  if (cnt > ONESHOT_MAX_TICKS)
+    cnt = ONESHOT_MAX_TICKS;
+
+  /* Nothing to gain from skipping a single tick. */
+  if (cnt < 2)
+    return;
+
+  oneshot_ticks = cnt;
+  pit_configure_oneshot (0, cnt * PIT_TICK_COUNT);
+}
+
+/* Called at the start of every external interrupt.  If the CPU
+   was idling with a one-shot countdown armed, accounts for the
+   timer ticks that went by without an interrupt and restarts the
+   periodic timer.
+
+   If the countdown expired, this is its timer interrupt, which
+   timer_interrupt() counts as the last tick of the countdown.
+   Otherwise another device woke the CPU up early and only the
+   whole ticks that passed are counted; the rest of the current
+   tick is lost when the periodic timer restarts. */
+void
+timer_idle_exit (void)
+{
+  int64_t skipped;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  if (oneshot_ticks == 0)
+    return;
+
+  if (pit_output_high (0))
+    skipped = oneshot_ticks - 1;
+  else
+    skipped = oneshot_ticks - DIV_ROUND_UP (pit_read_count (0),
+                                            PIT_TICK_COUNT);
+  oneshot_ticks = 0;
+  pit_configure_channel (0, 2, TIMER_FREQ);
+
+  if (skipped > 0)
+    {
+      ticks += skipped;
+      thread_idle_ticks (skipped);
+    }
+}
+
 /* Timer interrupt handler. */
 static void
 timer_interrupt (struct intr_frame *args UNUSED)
 {
   ticks++;
+  wake_sleepers ();
   thread_tick ();
 }
 
+/* Unblocks every sleeping thread whose wakeup tick has been
+   reached.  Only the root of the sleep heap is examined when no
+   thread is due. */
+static void
+wake_sleepers (void)
+{
+  while (sleep_heap != NULL && sleep_heap->ticks <= ticks)
+    {
+      struct thread *t = sleep_heap;
+      sleep_heap = sleep_merge_pairs (t->sleep_child);
+      t->sleep_child = NULL;
+      thread_unblock (t);
+    }
+}
+
+/* Melds the sleep heaps rooted at A and B, either of which may
+   be null, and returns the root of the result. */
+static struct thread *
+sleep_meld (struct thread *a, struct thread *b)
+{
+  if (a == NULL)
+    return b;
+  if (b == NULL)
+    return a;
+  if (b->ticks < a->ticks)
+    {
+      struct thread *tmp = a;
+      a = b;
+      b = tmp;
+    }
+  b->sleep_sibling = a->sleep_child;
+  a->sleep_child = b;
+  return a;
+}
+
+/* Combines the list of sibling heaps starting at FIRST into a
+   single heap and returns its root, using the standard
+   two-pass pairing: meld siblings pairwise from left to right,
+   then meld the pairs from right to left.  Iterative, so that
+   long sibling lists cannot overflow the kernel stack. */
+static struct thread *
+sleep_merge_pairs (struct thread *first)
+{
+  struct thread *pairs = NULL;
+  struct thread *root = NULL;
+
+  while (first != NULL)
+    {
+      struct thread *a = first;
+      struct thread *b = a->sleep_sibling;
+
+      first = b != NULL ? b->sleep_sibling : NULL;
+      a->sleep_sibling = NULL;
+      if (b != NULL)
+        b->sleep_sibling = NULL;
+
+      a = sleep_meld (a, b);
+      a->sleep_sibling = pairs;
+      pairs = a;
+    }
+
+  while (pairs != NULL)
+    {
+      struct thread *next = pairs->sleep_sibling;
+      pairs->sleep_sibling = NULL;
+      root = sleep_meld (root, pairs);
+      pairs = next;
+    }
+  return root;
+}
+
 /* Returns true if LOOPS iterations waits for more than one timer
    tick, otherwise false. */
 static bool
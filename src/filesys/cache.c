@@ -0,0 +1,507 @@
+#include "filesys/cache.h"
+#include <debug.h>
+#include <hash.h>
+#include <round.h>
+#include <stdlib.h>
+#include <string.h>
+#include "filesys/filesys.h"
+#include "devices/timer.h"
+#include "threads/malloc.h"
+#include "threads/palloc.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
+
+/* A cached sector.
+
+   An entry in use is in cache_map under its SECTOR.  Looking up
+   or replacing entries requires cache_lock.  Reading or writing
+   an entry's data, or its DIRTY and LOADED flags, requires the
+   entry's own LOCK.  A thread first pins the entry under
+   cache_lock, by incrementing PIN_CNT, so that it cannot be
+   evicted, and then acquires LOCK without holding cache_lock, so
+   that disk I/O on one entry does not hold up the others. */
+struct cache_entry
+  {
+    struct hash_elem elem;      /* Element in cache_map. */
+    block_sector_t sector;      /* Cached sector, if IN_USE. */
+    bool in_use;                /* Holds a sector? */
+    bool accessed;              /* Used since the clock hand passed? */
+    int pin_cnt;                /* Threads using or waiting for it. */
+
+    struct lock lock;           /* Protects the members below. */
+    bool loaded;                /* DATA read from disk? */
+    bool dirty;                 /* DATA newer than disk? */
+    uint8_t *data;              /* BLOCK_SECTOR_SIZE bytes. */
+  };
+
+size_t cache_size = CACHE_DEFAULT_SIZE;
+
+static struct cache_entry *cache;    /* Array of cache_size entries. */
+static struct hash cache_map;        /* In-use entries by sector. */
+static struct lock cache_lock;       /* Protects cache_map, pin_cnt.
+                                        Adaptive: never held across I/O. */
+static size_t clock_hand;            /* Next eviction candidate. */
+
+/* Most consecutive sectors that the read-ahead thread loads at
+   once. */
+#define READ_AHEAD_BATCH 8
+
+/* Ticks between write-behind flushes of dirty sectors. */
+#define WRITE_BEHIND_TICKS (5 * TIMER_FREQ)
+
+/* Sectors waiting to be read ahead, as a ring buffer.  Hints that
+   arrive while it is full are dropped. */
+#define READ_AHEAD_QUEUE 32
+static block_sector_t ra_queue[READ_AHEAD_QUEUE];
+static size_t ra_head, ra_cnt;       /* First hint, number of hints. */
+static struct lock ra_lock;          /* Protects the queue. */
+static struct condition ra_nonempty; /* Signaled when a hint arrives. */
+
+static hash_hash_func cache_hash;
+static hash_less_func cache_less;
+static struct cache_entry *cache_get (block_sector_t, bool load);
+static void cache_put (struct cache_entry *);
+static struct cache_entry *cache_find (block_sector_t);
+static void cache_flush_entry (struct cache_entry *);
+static thread_func read_ahead_daemon NO_RETURN;
+static thread_func write_behind_daemon NO_RETURN;
+
+/* Initializes the buffer cache. */
+void
+cache_init (void)
+{
+  uint8_t *data;
+  size_t i;
+
+  if (cache_size < 1)
+    PANIC ("buffer cache must have at least one entry");
+
+  cache = malloc (cache_size * sizeof *cache);
+  data = palloc_get_multiple (PAL_ASSERT,
+                              DIV_ROUND_UP (cache_size * BLOCK_SECTOR_SIZE,
+                                            PGSIZE));
+  if (cache == NULL || !hash_init (&cache_map, cache_hash, cache_less, NULL))
+    PANIC ("can't allocate buffer cache");
+  lock_init_adaptive (&cache_lock, "cache");
+
+  for (i = 0; i < cache_size; i++)
+    {
+      struct cache_entry *e = &cache[i];
+      e->in_use = false;
+      e->accessed = false;
+      e->pin_cnt = 0;
+      lock_init (&e->lock, "cache entry");
+      e->loaded = false;
+      e->dirty = false;
+      e->data = data + i * BLOCK_SECTOR_SIZE;
+    }
+
+  lock_init (&ra_lock, "read-ahead");
+  cond_init (&ra_nonempty);
+  thread_create ("read-ahead", PRI_DEFAULT, read_ahead_daemon, NULL);
+  thread_create ("write-behind", PRI_DEFAULT, write_behind_daemon, NULL);
+}
+
+/* Reads sector SECTOR into BUFFER, which must have room for
+   BLOCK_SECTOR_SIZE bytes. */
+void
+cache_read (block_sector_t sector, void *buffer)
+{
+  cache_read_at (sector, buffer, 0, BLOCK_SECTOR_SIZE);
+}
+
+/* Reads SIZE bytes starting at byte offset OFS within sector
+   SECTOR into BUFFER.  BUFFER must be in kernel memory, because
+   a page fault while the entry is locked could deadlock. */
+void
+cache_read_at (block_sector_t sector, void *buffer, size_t ofs, size_t size)
+{
+  struct cache_entry *e;
+
+  ASSERT (ofs + size <= BLOCK_SECTOR_SIZE);
+  ASSERT (is_kernel_vaddr (buffer));
+
+  e = cache_get (sector, true);
+  memcpy (buffer, e->data + ofs, size);
+  cache_put (e);
+}
+
+/* Writes BLOCK_SECTOR_SIZE bytes from BUFFER to sector SECTOR. */
+void
+cache_write (block_sector_t sector, const void *buffer)
+{
+  cache_write_at (sector, buffer, 0, BLOCK_SECTOR_SIZE);
+}
+
+/* Writes SIZE bytes from BUFFER into sector SECTOR, starting at
+   byte offset OFS within the sector.  The sector reaches the disk
+   when it is evicted or flushed.  As for cache_read_at(), BUFFER
+   must be in kernel memory. */
+void
+cache_write_at (block_sector_t sector, const void *buffer,
+                size_t ofs, size_t size)
+{
+  struct cache_entry *e;
+
+  ASSERT (ofs + size <= BLOCK_SECTOR_SIZE);
+  ASSERT (is_kernel_vaddr (buffer));
+
+  /* A write of the whole sector need not read it first. */
+  e = cache_get (sector, size < BLOCK_SECTOR_SIZE);
+  memcpy (e->data + ofs, buffer, size);
+  e->loaded = true;
+  e->dirty = true;
+  cache_put (e);
+}
+
+/* Compares the sectors of the cache entries that *A_ and *B_
+   point to, for qsort(). */
+static int
+compare_sectors (const void *a_, const void *b_)
+{
+  const struct cache_entry *const *a = a_;
+  const struct cache_entry *const *b = b_;
+
+  return (*a)->sector < (*b)->sector ? -1 : (*a)->sector > (*b)->sector;
+}
+
+/* Writes every dirty sector in the cache to disk.  The writes are
+   all submitted before any is waited for, so that the block layer
+   can sort them and merge adjacent ones. */
+void
+cache_flush (void)
+{
+  struct cache_entry **dirty = malloc (cache_size * sizeof *dirty);
+  struct block_request *reqs = malloc (cache_size * sizeof *reqs);
+  size_t dirty_cnt = 0, req_cnt = 0;
+  size_t i;
+
+  if (dirty == NULL || reqs == NULL)
+    {
+      /* Fall back to writing one sector at a time. */
+      for (i = 0; i < cache_size; i++)
+        {
+          lock_acquire (&cache_lock);
+          cache[i].pin_cnt++;
+          lock_release (&cache_lock);
+          cache_flush_entry (&cache[i]);
+        }
+      free (dirty);
+      free (reqs);
+      return;
+    }
+
+  /* Pin the dirty entries.  Their DIRTY flags are read without
+     their locks, which is only a guess, but an entry that is
+     dirtied later will be written by a later flush anyway. */
+  lock_acquire (&cache_lock);
+  for (i = 0; i < cache_size; i++)
+    if (cache[i].in_use && cache[i].dirty)
+      {
+        cache[i].pin_cnt++;
+        dirty[dirty_cnt++] = &cache[i];
+      }
+  lock_release (&cache_lock);
+
+  /* Lock the entries in ascending sector order, so that threads
+     that hold more than one entry cannot deadlock, and start
+     writing each one that is still dirty. */
+  qsort (dirty, dirty_cnt, sizeof *dirty, compare_sectors);
+  for (i = 0; i < dirty_cnt; i++)
+    {
+      struct cache_entry *e = dirty[i];
+
+      lock_acquire (&e->lock);
+      if (!e->dirty)
+        {
+          cache_put (e);
+          continue;
+        }
+      dirty[req_cnt] = e;
+      block_request_init (&reqs[req_cnt], fs_device, e->sector, 1, e->data,
+                          true);
+      block_submit (&reqs[req_cnt]);
+      req_cnt++;
+    }
+
+  for (i = 0; i < req_cnt; i++)
+    {
+      block_wait (&reqs[i]);
+      dirty[i]->dirty = false;
+      cache_put (dirty[i]);
+    }
+  free (dirty);
+  free (reqs);
+}
+
+/* Writes SECTOR to disk if it is cached and dirty. */
+void
+cache_flush_sector (block_sector_t sector)
+{
+  struct cache_entry *e;
+
+  lock_acquire (&cache_lock);
+  e = cache_find (sector);
+  if (e != NULL)
+    e->pin_cnt++;
+  lock_release (&cache_lock);
+
+  if (e != NULL)
+    cache_flush_entry (e);
+}
+
+/* Writes E to disk if it is dirty, then unpins it.  The caller
+   must have pinned E. */
+static void
+cache_flush_entry (struct cache_entry *e)
+{
+  lock_acquire (&e->lock);
+  if (e->in_use && e->dirty)
+    {
+      block_write (fs_device, e->sector, e->data);
+      e->dirty = false;
+    }
+  cache_put (e);
+}
+
+/* Write-behind thread.  Writes dirty sectors back to disk every
+   WRITE_BEHIND_TICKS, so that a crash loses only recent writes
+   while repeated writes to a sector still cost one disk write. */
+static void
+write_behind_daemon (void *aux UNUSED)
+{
+  for (;;)
+    {
+      timer_sleep (WRITE_BEHIND_TICKS);
+      cache_flush ();
+    }
+}
+
+/* Asks the read-ahead thread to bring SECTOR into the cache in
+   the background, unless it is already there.  Does not wait. */
+void
+cache_read_ahead (block_sector_t sector)
+{
+  bool cached;
+
+  lock_acquire (&cache_lock);
+  cached = cache_find (sector) != NULL;
+  lock_release (&cache_lock);
+  if (cached)
+    return;
+
+  lock_acquire (&ra_lock);
+  if (ra_cnt < READ_AHEAD_QUEUE)
+    {
+      ra_queue[(ra_head + ra_cnt++) % READ_AHEAD_QUEUE] = sector;
+      cond_signal (&ra_nonempty, &ra_lock);
+    }
+  lock_release (&ra_lock);
+}
+
+/* Read-ahead thread.  Loads the sectors queued by
+   cache_read_ahead(), in the order queued.  Hints for consecutive
+   sectors are served together, so that the block layer can merge
+   their reads into one disk request.  At most a quarter of the
+   cache is held at once, so that other threads can still find
+   entries to replace. */
+static void
+read_ahead_daemon (void *aux UNUSED)
+{
+  size_t max_cnt = cache_size / 4;
+
+  if (max_cnt > READ_AHEAD_BATCH)
+    max_cnt = READ_AHEAD_BATCH;
+  if (max_cnt < 1)
+    max_cnt = 1;
+
+  for (;;)
+    {
+      struct cache_entry *run[READ_AHEAD_BATCH];
+      struct block_request reqs[READ_AHEAD_BATCH];
+      block_sector_t sector;
+      size_t cnt, i;
+
+      lock_acquire (&ra_lock);
+      while (ra_cnt == 0)
+        cond_wait (&ra_nonempty, &ra_lock);
+      sector = ra_queue[ra_head];
+      cnt = 0;
+      do
+        {
+          ra_head = (ra_head + 1) % READ_AHEAD_QUEUE;
+          ra_cnt--;
+          cnt++;
+        }
+      while (cnt < max_cnt && ra_cnt > 0
+             && ra_queue[ra_head] == sector + cnt);
+      lock_release (&ra_lock);
+
+      /* Get the entries in ascending sector order, as cache_flush()
+         locks them, and start reading the ones not yet loaded. */
+      for (i = 0; i < cnt; i++)
+        {
+          run[i] = cache_get (sector + i, false);
+          if (!run[i]->loaded)
+            {
+              block_request_init (&reqs[i], fs_device, sector + i, 1,
+                                  run[i]->data, false);
+              block_submit (&reqs[i]);
+            }
+        }
+      for (i = 0; i < cnt; i++)
+        {
+          if (!run[i]->loaded)
+            {
+              block_wait (&reqs[i]);
+              run[i]->loaded = true;
+            }
+          cache_put (run[i]);
+        }
+    }
+}
+
+/* Returns the entry for SECTOR, or a null pointer if SECTOR is
+   not cached.  cache_lock must be held. */
+static struct cache_entry *
+cache_find (block_sector_t sector)
+{
+  struct cache_entry key;
+  struct hash_elem *e;
+
+  ASSERT (lock_held_by_current_thread (&cache_lock));
+
+  key.sector = sector;
+  e = hash_find (&cache_map, &key.elem);
+  return e != NULL ? hash_entry (e, struct cache_entry, elem) : NULL;
+}
+
+/* Chooses an unpinned entry to replace, using the clock
+   algorithm, and returns it.  Returns a null pointer if every
+   entry is pinned.  cache_lock must be held. */
+static struct cache_entry *
+cache_evict (void)
+{
+  size_t i;
+
+  ASSERT (lock_held_by_current_thread (&cache_lock));
+
+  /* Two sweeps clear every accessed bit, so an unpinned entry
+     turns up if there is one. */
+  for (i = 0; i < 2 * cache_size; i++)
+    {
+      struct cache_entry *e = &cache[clock_hand];
+      clock_hand = (clock_hand + 1) % cache_size;
+
+      if (e->pin_cnt > 0)
+        continue;
+      if (e->in_use && e->accessed)
+        e->accessed = false;
+      else
+        return e;
+    }
+  return NULL;
+}
+
+/* Returns the entry for SECTOR, pinned and with its lock held,
+   bringing the sector into the cache if necessary.  If LOAD is
+   true, the entry's data is read from disk if it is not already
+   there; otherwise, the caller must overwrite all of it. */
+static struct cache_entry *
+cache_get (block_sector_t sector, bool load)
+{
+  struct cache_entry *e;
+
+  lock_acquire (&cache_lock);
+  for (;;)
+    {
+      e = cache_find (sector);
+      if (e != NULL)
+        {
+          /* Hit.  If another thread is still loading the sector,
+             we wait for it on the entry's lock. */
+          e->pin_cnt++;
+          e->accessed = true;
+          lock_release (&cache_lock);
+          lock_acquire (&e->lock);
+          break;
+        }
+
+      e = cache_evict ();
+      if (e != NULL && e->in_use && e->dirty)
+        {
+          /* Write back the victim before giving it a new sector,
+             so that a reader of the old sector who misses cannot
+             fetch stale data from disk.  Then choose again, since
+             the victim may have been used in the meantime. */
+          e->pin_cnt++;
+          lock_acquire (&e->lock);
+          lock_release (&cache_lock);
+          block_write (fs_device, e->sector, e->data);
+          e->dirty = false;
+          cache_put (e);
+          lock_acquire (&cache_lock);
+        }
+      else if (e != NULL)
+        {
+          /* Miss.  Nobody has E pinned, so nobody holds its lock
+             and we can take it without waiting. */
+          if (e->in_use)
+            hash_delete (&cache_map, &e->elem);
+          e->sector = sector;
+          e->in_use = true;
+          e->accessed = true;
+          e->pin_cnt++;
+          hash_insert (&cache_map, &e->elem);
+          lock_acquire (&e->lock);
+          lock_release (&cache_lock);
+          e->loaded = false;
+          break;
+        }
+      else
+        {
+          /* Every entry is pinned.  Let their users finish. */
+          lock_release (&cache_lock);
+          thread_yield ();
+          lock_acquire (&cache_lock);
+        }
+    }
+
+  /* Read the sector without holding cache_lock. */
+  if (load && !e->loaded)
+    {
+      block_read (fs_device, sector, e->data);
+      e->loaded = true;
+    }
+  return e;
+}
+
+/* Releases E, which the caller got from cache_get(). */
+static void
+cache_put (struct cache_entry *e)
+{
+  lock_release (&e->lock);
+
+  lock_acquire (&cache_lock);
+  ASSERT (e->pin_cnt > 0);
+  e->pin_cnt--;
+  lock_release (&cache_lock);
+}
+
+/* Returns a hash value for the entry containing E. */
+static unsigned
+cache_hash (const struct hash_elem *e, void *aux UNUSED)
+{
+  return hash_int (hash_entry (e, struct cache_entry, elem)->sector);
+}
+
+/* Returns true if the entry containing A precedes the one
+   containing B in sector order. */
+static bool
+cache_less (const struct hash_elem *a, const struct hash_elem *b,
+            void *aux UNUSED)
+{
+  return (hash_entry (a, struct cache_entry, elem)->sector
+          < hash_entry (b, struct cache_entry, elem)->sector);
+}
@@ -0,0 +1,24 @@
+#ifndef FILESYS_CACHE_H
+#define FILESYS_CACHE_H
+
+#include <stddef.h>
+#include "devices/block.h"
+
+/* Default number of sectors in the buffer cache. */
+#define CACHE_DEFAULT_SIZE 64
+
+/* Number of sectors in the buffer cache.  Set by kernel
+   command-line option "-cache=N"; must be set before
+   cache_init() is called. */
+extern size_t cache_size;
+
+void cache_init (void);
+void cache_read (block_sector_t, void *);
+void cache_read_at (block_sector_t, void *, size_t ofs, size_t size);
+void cache_write (block_sector_t, const void *);
+void cache_write_at (block_sector_t, const void *, size_t ofs, size_t size);
+void cache_flush (void);
+void cache_flush_sector (block_sector_t);
+void cache_read_ahead (block_sector_t);
+
+#endif /* filesys/cache.h */
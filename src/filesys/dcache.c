@@ -0,0 +1,171 @@
+#include "filesys/dcache.h"
+#include <debug.h>
+#include <hash.h>
+#include <list.h>
+#include <string.h>
+#include "filesys/directory.h"
+#include "threads/synch.h"
+
+/* A cached name.
+
+   Maps NAME in the directory whose inode is in sector DIR to the
+   sector of the named file's inode, or to 0 if the directory has
+   no such file.  Sector 0 holds the free map, so it is never a
+   file's inode.
+
+   The directory code keeps the cache up to date: it adds or
+   replaces names while holding the directory's lock, so that a
+   name found in the cache is the same as one found on disk. */
+struct dcache_entry
+  {
+    struct hash_elem hash_elem;         /* Element in dcache_map. */
+    struct list_elem lru_elem;          /* Element in lru_list. */
+    block_sector_t dir;                 /* Directory inode sector. */
+    char name[NAME_MAX + 1];            /* Name within DIR. */
+    block_sector_t sector;              /* File inode sector, or 0. */
+  };
+
+static struct dcache_entry dcache[DCACHE_SIZE];
+static struct hash dcache_map;       /* In-use entries by DIR, NAME. */
+static struct list lru_list;         /* All entries, most recent first. */
+static struct lock dcache_lock;      /* Protects all of the above. */
+
+static hash_hash_func dcache_hash;
+static hash_less_func dcache_less;
+static struct dcache_entry *dcache_find (block_sector_t, const char *);
+
+/* Initializes the directory entry cache. */
+void
+dcache_init (void)
+{
+  size_t i;
+
+  if (!hash_init (&dcache_map, dcache_hash, dcache_less, NULL))
+    PANIC ("can't allocate directory entry cache");
+  list_init (&lru_list);
+  lock_init (&dcache_lock, "dcache");
+
+  /* Unused entries have an empty name and sit at the back of
+     lru_list, to be taken first. */
+  for (i = 0; i < DCACHE_SIZE; i++)
+    {
+      dcache[i].name[0] = '\0';
+      list_push_back (&lru_list, &dcache[i].lru_elem);
+    }
+}
+
+/* Looks up NAME in the directory whose inode is in sector DIR.
+   If the cache knows NAME, returns true and sets *SECTORP to the
+   sector of the file's inode, or to 0 if there is no such file.
+   Otherwise, returns false. */
+bool
+dcache_lookup (block_sector_t dir, const char *name, block_sector_t *sectorp)
+{
+  struct dcache_entry *e;
+
+  lock_acquire (&dcache_lock);
+  e = dcache_find (dir, name);
+  if (e != NULL)
+    {
+      *sectorp = e->sector;
+      list_remove (&e->lru_elem);
+      list_push_front (&lru_list, &e->lru_elem);
+    }
+  lock_release (&dcache_lock);
+  return e != NULL;
+}
+
+/* Records that NAME in the directory whose inode is in sector
+   DIR names the file whose inode is in SECTOR, or, if SECTOR is
+   0, that there is no such file.  Replaces the least recently
+   used name if the cache is full.  Names longer than NAME_MAX,
+   which no file can have, are not cached. */
+void
+dcache_insert (block_sector_t dir, const char *name, block_sector_t sector)
+{
+  struct dcache_entry *e;
+
+  if (strlen (name) > NAME_MAX)
+    return;
+
+  lock_acquire (&dcache_lock);
+  e = dcache_find (dir, name);
+  if (e == NULL)
+    {
+      e = list_entry (list_back (&lru_list), struct dcache_entry, lru_elem);
+      if (e->name[0] != '\0')
+        hash_delete (&dcache_map, &e->hash_elem);
+      e->dir = dir;
+      strlcpy (e->name, name, sizeof e->name);
+      hash_insert (&dcache_map, &e->hash_elem);
+    }
+  e->sector = sector;
+  list_remove (&e->lru_elem);
+  list_push_front (&lru_list, &e->lru_elem);
+  lock_release (&dcache_lock);
+}
+
+/* Forgets every name in the directory whose inode is in sector
+   DIR, which must be done before a new directory is created in
+   that sector. */
+void
+dcache_purge (block_sector_t dir)
+{
+  size_t i;
+
+  lock_acquire (&dcache_lock);
+  for (i = 0; i < DCACHE_SIZE; i++)
+    {
+      struct dcache_entry *e = &dcache[i];
+      if (e->name[0] != '\0' && e->dir == dir)
+        {
+          hash_delete (&dcache_map, &e->hash_elem);
+          e->name[0] = '\0';
+          list_remove (&e->lru_elem);
+          list_push_back (&lru_list, &e->lru_elem);
+        }
+    }
+  lock_release (&dcache_lock);
+}
+
+/* Returns the entry for NAME in DIR, or a null pointer if there
+   is none.  dcache_lock must be held. */
+static struct dcache_entry *
+dcache_find (block_sector_t dir, const char *name)
+{
+  static struct dcache_entry key;
+  struct hash_elem *e;
+
+  ASSERT (lock_held_by_current_thread (&dcache_lock));
+
+  if (strlen (name) > NAME_MAX)
+    return NULL;
+  key.dir = dir;
+  strlcpy (key.name, name, sizeof key.name);
+  e = hash_find (&dcache_map, &key.hash_elem);
+  return e != NULL ? hash_entry (e, struct dcache_entry, hash_elem) : NULL;
+}
+
+/* Returns a hash value for the directory and name of entry E. */
+static unsigned
+dcache_hash (const struct hash_elem *e_, void *aux UNUSED)
+{
+  const struct dcache_entry *e = hash_entry (e_, struct dcache_entry,
+                                             hash_elem);
+  return hash_string (e->name) ^ hash_int (e->dir);
+}
+
+/* Returns true if entry A precedes entry B in directory, then
+   name, order. */
+static bool
+dcache_less (const struct hash_elem *a_, const struct hash_elem *b_,
+             void *aux UNUSED)
+{
+  const struct dcache_entry *a = hash_entry (a_, struct dcache_entry,
+                                             hash_elem);
+  const struct dcache_entry *b = hash_entry (b_, struct dcache_entry,
+                                             hash_elem);
+  if (a->dir != b->dir)
+    return a->dir < b->dir;
+  return strcmp (a->name, b->name) < 0;
+}
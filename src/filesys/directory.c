@@ -1,7 +1,10 @@
 #include "filesys/directory.h"
 #include <stdio.h>
 #include <string.h>
+#include <hash.h>
 #include <list.h>
+#include <round.h>
+#include "filesys/dcache.h"
 #include "filesys/filesys.h"
 #include "filesys/inode.h"
 #include "threads/malloc.h"
@@ -10,7 +13,7 @@
 struct dir 
   {
     struct inode *inode;                /* Backing store. */
-    off_t pos;                          /* Current position. */
+    off_t pos;                          /* Next slot for dir_readdir(). */
   };
 
 /* A single directory entry. */
@@ -18,15 +21,91 @@ struct dir_entry
   {
     block_sector_t inode_sector;        /* Sector number of header. */
     char name[NAME_MAX + 1];            /* Null terminated file name. */
-    bool in_use;                        /* In use or free? */
+    uint8_t state;                      /* SLOT_FREE, SLOT_USED, SLOT_DELETED. */
   };
 
+/* States of a directory entry slot. */
+#define SLOT_FREE 0                     /* Never used. */
+#define SLOT_USED 1                     /* Holds an entry. */
+#define SLOT_DELETED 2                  /* Held an entry that was removed. */
+
+/* A directory is stored as a hash table of entries, keyed on the
+   entry's name and resolved by linear probing.  The first sector
+   of the directory's inode holds this header.  The table follows
+   in the next SECTOR_CNT sectors, each holding SLOTS_PER_SECTOR
+   entries so that no entry spans two sectors.
+
+   Removing an entry leaves a SLOT_DELETED marker behind, so that
+   lookups still probe past it.  Once the used and deleted slots
+   fill half the table, the next dir_add() rebuilds it, dropping
+   the markers and doubling its size as needed to bring it back
+   to at most a quarter full.  Lookup, add and remove therefore
+   read only a couple of entries on average, however large the
+   directory.
+
+   The names "." and ".." are not stored as entries.  dir_lookup()
+   answers them from the directory itself and from PARENT. */
+struct dir_header
+  {
+    uint32_t sector_cnt;                /* Sectors in the table. */
+    uint32_t used_cnt;                  /* Slots in use. */
+    uint32_t deleted_cnt;               /* Slots marked deleted. */
+    block_sector_t parent;              /* Parent directory's inode. */
+  };
+
+/* Number of entries in a sector of the table. */
+#define SLOTS_PER_SECTOR (BLOCK_SECTOR_SIZE / sizeof (struct dir_entry))
+
+/* Returns the byte offset in a directory of slot SLOT of a table
+   that starts at sector FIRST of the directory. */
+static inline off_t
+slot_ofs (size_t first, size_t slot)
+{
+  return ((first + slot / SLOTS_PER_SECTOR) * BLOCK_SECTOR_SIZE
+          + slot % SLOTS_PER_SECTOR * sizeof (struct dir_entry));
+}
+
+/* Reads DIR's header into *H.  Returns true if successful. */
+static bool
+read_header (const struct dir *dir, struct dir_header *h)
+{
+  return inode_read_at (dir->inode, h, sizeof *h, 0) == sizeof *h;
+}
+
+/* Writes H as DIR's header.  Returns true if successful. */
+static bool
+write_header (struct dir *dir, const struct dir_header *h)
+{
+  return inode_write_at (dir->inode, h, sizeof *h, 0) == sizeof *h;
+}
+
 /* Creates a directory with space for ENTRY_CNT entries in the
-   given SECTOR.  Returns true if successful, false on failure. */
+   given SECTOR, as a subdirectory of the directory whose inode is
+   in sector PARENT.  Returns true if successful, false on
+   failure. */
 bool
-dir_create (block_sector_t sector, size_t entry_cnt)
+dir_create (block_sector_t sector, size_t entry_cnt, block_sector_t parent)
 {
-  return inode_create (sector, entry_cnt * sizeof (struct dir_entry));
+  struct dir_header h;
+  struct dir *dir;
+  bool success;
+
+  h.sector_cnt = DIV_ROUND_UP (entry_cnt * 2, SLOTS_PER_SECTOR);
+  if (h.sector_cnt == 0)
+    h.sector_cnt = 1;
+  h.used_cnt = h.deleted_cnt = 0;
+  h.parent = parent;
+  if (!inode_create (sector, (h.sector_cnt + 1) * BLOCK_SECTOR_SIZE, true))
+    return false;
+  dcache_purge (sector);
+
+  /* The table is all zeros, that is, all free slots. */
+  dir = dir_open (inode_open (sector));
+  if (dir == NULL)
+    return false;
+  success = write_header (dir, &h);
+  dir_close (dir);
+  return success;
 }
 
 /* Opens and returns the directory for the given INODE, of which
@@ -83,51 +162,164 @@ dir_get_inode (struct dir *dir)
   return dir->inode;
 }
 
-/* Searches DIR for a file with the given NAME.
+/* Searches the table of SLOT_CNT slots that starts at sector
+   FIRST of DIR for a file with the given NAME.
    If successful, returns true, sets *EP to the directory entry
    if EP is non-null, and sets *OFSP to the byte offset of the
    directory entry if OFSP is non-null.
-   otherwise, returns false and ignores EP and OFSP. */
+   Otherwise, returns false and, if OFSP is non-null, sets *OFSP
+   to the offset of the slot where an entry for NAME should be
+   added, or to -1 if the table is full or cannot be read. */
 static bool
-lookup (const struct dir *dir, const char *name,
-        struct dir_entry *ep, off_t *ofsp) 
+lookup_in (const struct dir *dir, size_t first, size_t slot_cnt,
+           const char *name, struct dir_entry *ep, off_t *ofsp) 
 {
   struct dir_entry e;
-  size_t ofs;
+  off_t free_ofs = -1;
+  size_t slot, i;
   
   ASSERT (dir != NULL);
   ASSERT (name != NULL);
 
-  for (ofs = 0; inode_read_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
-       ofs += sizeof e) 
-    if (e.in_use && !strcmp (name, e.name)) 
-      {
-        if (ep != NULL)
-          *ep = e;
-        if (ofsp != NULL)
-          *ofsp = ofs;
-        return true;
-      }
+  slot = hash_string (name) % slot_cnt;
+  for (i = 0; i < slot_cnt; i++, slot = (slot + 1) % slot_cnt)
+    {
+      off_t ofs = slot_ofs (first, slot);
+      if (inode_read_at (dir->inode, &e, sizeof e, ofs) != sizeof e)
+        break;
+      if (e.state == SLOT_USED)
+        {
+          if (!strcmp (name, e.name))
+            {
+              if (ep != NULL)
+                *ep = e;
+              if (ofsp != NULL)
+                *ofsp = ofs;
+              return true;
+            }
+        }
+      else
+        {
+          if (free_ofs == -1)
+            free_ofs = ofs;
+          if (e.state == SLOT_FREE)
+            break;
+        }
+    }
+  if (ofsp != NULL)
+    *ofsp = free_ofs;
   return false;
 }
 
+/* Searches DIR, whose header is H, for a file with the given
+   NAME, as lookup_in() does. */
+static bool
+lookup (const struct dir *dir, const struct dir_header *h, const char *name,
+        struct dir_entry *ep, off_t *ofsp) 
+{
+  return lookup_in (dir, 1, h->sector_cnt * SLOTS_PER_SECTOR, name, ep, ofsp);
+}
+
+/* Rebuilds the table of DIR, whose header is H, with SECTOR_CNT
+   sectors, dropping deleted slots, and updates H to match.
+   Returns true if successful, false if a disk or memory error
+   occurs, in which case DIR is unchanged.
+
+   The new table is built just past the old one, then copied down
+   over it, so that the directory need grow only to the combined
+   size of the two.  The unused tail is left in place to be reused
+   by the next rebuild. */
+static bool
+rebuild (struct dir *dir, struct dir_header *h, size_t sector_cnt)
+{
+  static const char zeros[BLOCK_SECTOR_SIZE];
+  size_t old_cnt = h->sector_cnt * SLOTS_PER_SECTOR;
+  size_t new_cnt = sector_cnt * SLOTS_PER_SECTOR;
+  size_t first = 1 + h->sector_cnt;
+  struct dir_entry e;
+  uint8_t *buffer;
+  size_t i;
+
+  /* Clear the new table. */
+  for (i = 0; i < sector_cnt; i++)
+    if (inode_write_at (dir->inode, zeros, BLOCK_SECTOR_SIZE,
+                        (first + i) * BLOCK_SECTOR_SIZE) != BLOCK_SECTOR_SIZE)
+      return false;
+
+  /* Move every entry into it. */
+  for (i = 0; i < old_cnt; i++)
+    {
+      off_t ofs;
+      if (inode_read_at (dir->inode, &e, sizeof e, slot_ofs (1, i))
+          != sizeof e)
+        return false;
+      if (e.state != SLOT_USED)
+        continue;
+      lookup_in (dir, first, new_cnt, e.name, NULL, &ofs);
+      if (ofs == -1
+          || inode_write_at (dir->inode, &e, sizeof e, ofs) != sizeof e)
+        return false;
+    }
+
+  /* Copy it down.  Each sector is copied before it is overwritten,
+     because sector I of the new table lands on sector I of the
+     old one, or on sector I - H->sector_cnt of the new one. */
+  buffer = malloc (BLOCK_SECTOR_SIZE);
+  if (buffer == NULL)
+    return false;
+  for (i = 0; i < sector_cnt; i++)
+    {
+      inode_read_at (dir->inode, buffer, BLOCK_SECTOR_SIZE,
+                     (first + i) * BLOCK_SECTOR_SIZE);
+      inode_write_at (dir->inode, buffer, BLOCK_SECTOR_SIZE,
+                      (1 + i) * BLOCK_SECTOR_SIZE);
+    }
+  free (buffer);
+
+  h->sector_cnt = sector_cnt;
+  h->deleted_cnt = 0;
+  return write_header (dir, h);
+}
+
 /* Searches DIR for a file with the given NAME
    and returns true if one exists, false otherwise.
+   A directory that has been removed contains nothing, not even
+   "." and "..".
    On success, sets *INODE to an inode for the file, otherwise to
    a null pointer.  The caller must close *INODE. */
 bool
 dir_lookup (const struct dir *dir, const char *name,
             struct inode **inode) 
 {
+  block_sector_t dir_sector, sector;
+  struct dir_header h;
   struct dir_entry e;
 
   ASSERT (dir != NULL);
   ASSERT (name != NULL);
 
-  if (lookup (dir, name, &e, NULL))
-    *inode = inode_open (e.inode_sector);
-  else
-    *inode = NULL;
+  /* Names looked up recently, including ones that were not found,
+     are answered from the directory entry cache. */
+  dir_sector = inode_get_inumber (dir->inode);
+  inode_lock_dir_shared (dir->inode);
+  if (inode_is_removed (dir->inode))
+    sector = 0;
+  else if (!strcmp (name, "."))
+    sector = dir_sector;
+  else if (!strcmp (name, ".."))
+    sector = read_header (dir, &h) ? h.parent : 0;
+  else if (!dcache_lookup (dir_sector, name, &sector))
+    {
+      if (!read_header (dir, &h))
+        sector = 0;
+      else
+        {
+          sector = lookup (dir, &h, name, &e, NULL) ? e.inode_sector : 0;
+          dcache_insert (dir_sector, name, sector);
+        }
+    }
+  *inode = sector != 0 ? inode_open (sector) : NULL;
+  inode_unlock_dir (dir->inode);
 
   return *inode != NULL;
 }
@@ -136,11 +328,12 @@ dir_lookup (const struct dir *dir, const char *name,
    file by that name.  The file's inode is in sector
    INODE_SECTOR.
    Returns true if successful, false on failure.
-   Fails if NAME is invalid (i.e. too long) or a disk or memory
-   error occurs. */
+   Fails if NAME is invalid (i.e. too long, "." or ".."), if DIR
+   has been removed, or if a disk or memory error occurs. */
 bool
 dir_add (struct dir *dir, const char *name, block_sector_t inode_sector)
 {
+  struct dir_header h;
   struct dir_entry e;
   off_t ofs;
   bool success = false;
@@ -149,41 +342,56 @@ dir_add (struct dir *dir, const char *name, block_sector_t inode_sector)
   ASSERT (name != NULL);
 
   /* Check NAME for validity. */
-  if (*name == '\0' || strlen (name) > NAME_MAX)
+  if (*name == '\0' || strlen (name) > NAME_MAX
+      || !strcmp (name, ".") || !strcmp (name, ".."))
     return false;
 
-  /* Check that NAME is not in use. */
-  if (lookup (dir, name, NULL, NULL))
+  /* Check that NAME is not in use, finding the slot for it along
+     the way. */
+  inode_lock_dir (dir->inode);
+  if (inode_is_removed (dir->inode)
+      || !read_header (dir, &h) || lookup (dir, &h, name, NULL, &ofs))
     goto done;
 
-  /* Set OFS to offset of free slot.
-     If there are no free slots, then it will be set to the
-     current end-of-file.
-     
-     inode_read_at() will only return a short read at end of file.
-     Otherwise, we'd need to verify that we didn't get a short
-     read due to something intermittent such as low memory. */
-  for (ofs = 0; inode_read_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
-       ofs += sizeof e) 
-    if (!e.in_use)
-      break;
+  /* Rebuild the table first if it is half full. */
+  if ((h.used_cnt + h.deleted_cnt + 1) * 2
+      > h.sector_cnt * SLOTS_PER_SECTOR)
+    {
+      size_t sector_cnt = h.sector_cnt;
+      while ((h.used_cnt + 1) * 4 > sector_cnt * SLOTS_PER_SECTOR)
+        sector_cnt *= 2;
+      if (!rebuild (dir, &h, sector_cnt))
+        goto done;
+      lookup (dir, &h, name, NULL, &ofs);
+    }
+  if (ofs == -1 || inode_read_at (dir->inode, &e, sizeof e, ofs) != sizeof e)
+    goto done;
 
   /* Write slot. */
-  e.in_use = true;
+  if (e.state == SLOT_DELETED)
+    h.deleted_cnt--;
+  e.state = SLOT_USED;
   strlcpy (e.name, name, sizeof e.name);
   e.inode_sector = inode_sector;
-  success = inode_write_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
+  if (inode_write_at (dir->inode, &e, sizeof e, ofs) != sizeof e)
+    goto done;
+  dcache_insert (inode_get_inumber (dir->inode), name, inode_sector);
+  h.used_cnt++;
+  success = write_header (dir, &h);
 
  done:
+  inode_unlock_dir (dir->inode);
   return success;
 }
 
 /* Removes any entry for NAME in DIR.
    Returns true if successful, false on failure,
-   which occurs only if there is no file with the given NAME. */
+   which occurs if there is no file with the given NAME or if it
+   is a directory that is not empty. */
 bool
 dir_remove (struct dir *dir, const char *name) 
 {
+  struct dir_header h;
   struct dir_entry e;
   struct inode *inode = NULL;
   bool success = false;
@@ -193,7 +401,8 @@ dir_remove (struct dir *dir, const char *name)
   ASSERT (name != NULL);
 
   /* Find directory entry. */
-  if (!lookup (dir, name, &e, &ofs))
+  inode_lock_dir (dir->inode);
+  if (!read_header (dir, &h) || !lookup (dir, &h, name, &e, &ofs))
     goto done;
 
   /* Open inode. */
@@ -201,36 +410,69 @@ dir_remove (struct dir *dir, const char *name)
   if (inode == NULL)
     goto done;
 
+  /* Only an empty directory may be removed.  Its lock is taken
+     after DIR's, the same order as a path walk from DIR would. */
+  if (inode_is_dir (inode))
+    {
+      struct dir child;
+      struct dir_header child_h;
+      bool empty;
+
+      child.inode = inode;
+      inode_lock_dir (inode);
+      empty = read_header (&child, &child_h) && child_h.used_cnt == 0;
+      if (empty)
+        inode_remove (inode);
+      inode_unlock_dir (inode);
+      if (!empty)
+        goto done;
+    }
+
   /* Erase directory entry. */
-  e.in_use = false;
+  e.state = SLOT_DELETED;
   if (inode_write_at (dir->inode, &e, sizeof e, ofs) != sizeof e) 
     goto done;
+  dcache_insert (inode_get_inumber (dir->inode), name, 0);
+  h.used_cnt--;
+  h.deleted_cnt++;
+  write_header (dir, &h);
 
   /* Remove inode. */
   inode_remove (inode);
   success = true;
 
  done:
+  inode_unlock_dir (dir->inode);
   inode_close (inode);
   return success;
 }
 
 /* Reads the next directory entry in DIR and stores the name in
    NAME.  Returns true if successful, false if the directory
-   contains no more entries. */
+   contains no more entries.  Entries are returned in table
+   order, which has nothing to do with the order they were
+   added in. */
 bool
 dir_readdir (struct dir *dir, char name[NAME_MAX + 1])
 {
+  struct dir_header h;
   struct dir_entry e;
+  bool found = false;
 
-  while (inode_read_at (dir->inode, &e, sizeof e, dir->pos) == sizeof e) 
-    {
-      dir->pos += sizeof e;
-      if (e.in_use)
-        {
-          strlcpy (name, e.name, NAME_MAX + 1);
-          return true;
-        } 
-    }
-  return false;
+  inode_lock_dir_shared (dir->inode);
+  if (read_header (dir, &h))
+    while ((size_t) dir->pos < h.sector_cnt * SLOTS_PER_SECTOR
+           && inode_read_at (dir->inode, &e, sizeof e,
+                             slot_ofs (1, dir->pos)) == sizeof e)
+      {
+        dir->pos++;
+        if (e.state == SLOT_USED)
+          {
+            strlcpy (name, e.name, NAME_MAX + 1);
+            found = true;
+            break;
+          } 
+      }
+  inode_unlock_dir (dir->inode);
+  return found;
 }
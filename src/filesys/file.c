@@ -166,3 +166,11 @@ file_tell (struct file *file)
   ASSERT (file != NULL);
   return file->pos;
 }
+
+/* Writes FILE's cached data to disk. */
+void
+file_flush (struct file *file) 
+{
+  ASSERT (file != NULL);
+  inode_flush (file->inode);
+}
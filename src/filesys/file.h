@@ -26,4 +26,7 @@ void file_seek (struct file *, off_t);
 off_t file_tell (struct file *);
 off_t file_length (struct file *);
 
+/* Writing back. */
+void file_flush (struct file *);
+
 #endif /* filesys/file.h */
@@ -2,10 +2,13 @@
 #include <debug.h>
 #include <stdio.h>
 #include <string.h>
+#include "filesys/cache.h"
+#include "filesys/dcache.h"
 #include "filesys/file.h"
 #include "filesys/free-map.h"
 #include "filesys/inode.h"
 #include "filesys/directory.h"
+#include "threads/thread.h"
 
 /* Partition that contains the file system. */
 struct block *fs_device;
@@ -21,7 +24,9 @@ filesys_init (bool format)
   if (fs_device == NULL)
     PANIC ("No file system device found, can't initialize file system.");
 
+  cache_init ();
   inode_init ();
+  dcache_init ();
   free_map_init ();
 
   if (format) 
@@ -36,8 +41,85 @@ void
 filesys_done (void) 
 {
   free_map_close ();
+  cache_flush ();
 }
 
+/* Opens the current directory of the running process, or the
+   root directory if it has none.  Returns a null pointer on
+   failure. */
+static struct dir *
+open_cwd (void)
+{
+#ifdef USERPROG
+  struct dir *cwd = thread_current ()->cwd;
+  if (cwd != NULL)
+    return dir_reopen (cwd);
+#endif
+  return dir_open_root ();
+}
+
+/* Resolves PATH, an absolute path or one relative to the current
+   directory, up to its last component.  On success, returns true,
+   stores the opened directory that should contain the last
+   component in *DIRP, which the caller must close, and copies the
+   last component into NAME, which is set to the empty string if
+   PATH names the root directory.  Returns false if PATH is empty,
+   if a component is too long, or if a component other than the
+   last is not an existing directory. */
+static bool
+resolve (const char *path, struct dir **dirp, char name[NAME_MAX + 1])
+{
+  struct dir *dir;
+
+  if (*path == '\0')
+    return false;
+  dir = *path == '/' ? dir_open_root () : open_cwd ();
+  if (dir == NULL)
+    return false;
+
+  name[0] = '\0';
+  for (;;)
+    {
+      size_t len;
+
+      path += strspn (path, "/");
+      if (*path == '\0')
+        break;
+      len = strcspn (path, "/");
+      if (len > NAME_MAX)
+        goto fail;
+
+      /* Step into the previous component, which must be a
+         directory. */
+      if (name[0] != '\0')
+        {
+          struct inode *inode;
+
+          if (!dir_lookup (dir, name, &inode))
+            goto fail;
+          dir_close (dir);
+          if (!inode_is_dir (inode))
+            {
+              inode_close (inode);
+              return false;
+            }
+          dir = dir_open (inode);
+          if (dir == NULL)
+            return false;
+        }
+
+      memcpy (name, path, len);
+      name[len] = '\0';
+      path += len;
+    }
+  *dirp = dir;
+  return true;
+
+ fail:
+  dir_close (dir);
+  return false;
+}
+
 /* Creates a file named NAME with the given INITIAL_SIZE.
    Returns true if successful, false otherwise.
    Fails if a file named NAME already exists,
@@ -46,11 +128,40 @@ bool
 filesys_create (const char *name, off_t initial_size) 
 {
   block_sector_t inode_sector = 0;
-  struct dir *dir = dir_open_root ();
-  bool success = (dir != NULL
-                  && free_map_allocate (1, &inode_sector)
-                  && inode_create (inode_sector, initial_size)
-                  && dir_add (dir, name, inode_sector));
+  char last[NAME_MAX + 1];
+  struct dir *dir;
+  bool success;
+
+  if (!resolve (name, &dir, last))
+    return false;
+  success = (free_map_allocate (1, &inode_sector)
+             && inode_create (inode_sector, initial_size, false)
+             && dir_add (dir, last, inode_sector));
+  if (!success && inode_sector != 0) 
+    free_map_release (inode_sector, 1);
+  dir_close (dir);
+
+  return success;
+}
+
+/* Creates a directory named NAME.
+   Returns true if successful, false otherwise.
+   Fails if a file named NAME already exists,
+   or if internal memory allocation fails. */
+bool
+filesys_mkdir (const char *name)
+{
+  block_sector_t inode_sector = 0;
+  char last[NAME_MAX + 1];
+  struct dir *dir;
+  bool success;
+
+  if (!resolve (name, &dir, last))
+    return false;
+  success = (free_map_allocate (1, &inode_sector)
+             && dir_create (inode_sector, 0,
+                            inode_get_inumber (dir_get_inode (dir)))
+             && dir_add (dir, last, inode_sector));
   if (!success && inode_sector != 0) 
     free_map_release (inode_sector, 1);
   dir_close (dir);
@@ -58,6 +169,26 @@ filesys_create (const char *name, off_t initial_size)
   return success;
 }
 
+/* Opens the inode of the file or directory with the given NAME
+   and returns it, or a null pointer if there is none. */
+static struct inode *
+open_inode (const char *name)
+{
+  char last[NAME_MAX + 1];
+  struct inode *inode = NULL;
+  struct dir *dir;
+
+  if (!resolve (name, &dir, last))
+    return NULL;
+  if (last[0] == '\0')
+    inode = inode_reopen (dir_get_inode (dir));
+  else
+    dir_lookup (dir, last, &inode);
+  dir_close (dir);
+
+  return inode;
+}
+
 /* Opens the file with the given NAME.
    Returns the new file if successful or a null pointer
    otherwise.
@@ -66,14 +197,7 @@ filesys_create (const char *name, off_t initial_size)
 struct file *
 filesys_open (const char *name)
 {
-  struct dir *dir = dir_open_root ();
-  struct inode *inode = NULL;
-
-  if (dir != NULL)
-    dir_lookup (dir, name, &inode);
-  dir_close (dir);
-
-  return file_open (inode);
+  return file_open (open_inode (name));
 }
 
 /* Deletes the file named NAME.
@@ -83,20 +207,54 @@ filesys_open (const char *name)
 bool
 filesys_remove (const char *name) 
 {
-  struct dir *dir = dir_open_root ();
-  bool success = dir != NULL && dir_remove (dir, name);
+  char last[NAME_MAX + 1];
+  struct dir *dir;
+  bool success;
+
+  if (!resolve (name, &dir, last))
+    return false;
+  success = dir_remove (dir, last);
   dir_close (dir); 
 
   return success;
 }
-
+
+#ifdef USERPROG
+/* Makes the directory named NAME the running process's current
+   directory.
+   Returns true if successful, false on failure.
+   Fails if NAME does not name a directory. */
+bool
+filesys_chdir (const char *name)
+{
+  struct inode *inode = open_inode (name);
+  struct thread *t = thread_current ();
+  struct dir *dir;
+
+  if (inode == NULL)
+    return false;
+  if (!inode_is_dir (inode))
+    {
+      inode_close (inode);
+      return false;
+    }
+  dir = dir_open (inode);
+  if (dir == NULL)
+    return false;
+
+  dir_close (t->cwd);
+  t->cwd = dir;
+  return true;
+}
+#endif
+
 /* Formats the file system. */
 static void
 do_format (void)
 {
   printf ("Formatting file system...");
   free_map_create ();
-  if (!dir_create (ROOT_DIR_SECTOR, 16))
+  if (!dir_create (ROOT_DIR_SECTOR, 16, ROOT_DIR_SECTOR))
     PANIC ("root directory creation failed");
   free_map_close ();
   printf ("done.\n");
@@ -1,12 +1,71 @@
 #include "filesys/free-map.h"
 #include <bitmap.h>
 #include <debug.h>
+#include <hash.h>
+#include <stdio.h>
 #include "filesys/file.h"
 #include "filesys/filesys.h"
 #include "filesys/inode.h"
+#include "threads/malloc.h"
+#include "threads/synch.h"
+#include "devices/timer.h"
 
 static struct file *free_map_file;   /* Free map file. */
 static struct bitmap *free_map;      /* Free map, one bit per sector. */
+static struct lock free_map_lock;    /* Protects free_map and its file. */
+
+/* Each change to free_map is written to free_map_file as soon as
+   it is made, but only the few bytes that changed, so that it
+   costs at most a sector's worth of copying into the buffer
+   cache.  The cache writes the dirty free-map sectors to disk in
+   the background, batching many changes, and free_map_close()
+   writes out whatever is left. */
+
+/* In-memory index of the free sectors in free_map.
+
+   Each maximal run of free sectors is an extent.  The extents
+   are hashed by their first sector and by the sector just past
+   their end, so that a released run can be merged with its
+   neighbors in constant time.  They are also kept in an AVL tree
+   ordered by size and then by first sector, so that the best fit
+   for an allocation, or the largest extent, is found in time
+   logarithmic in the number of extents.
+
+   The bitmap remains the on-disk format; the index is rebuilt
+   from it whenever the free map is read.  Protected by
+   free_map_lock. */
+struct extent
+  {
+    block_sector_t start;               /* First free sector. */
+    size_t cnt;                         /* Number of free sectors. */
+    struct hash_elem start_elem;        /* Element in extents_by_start. */
+    struct hash_elem end_elem;          /* Element in extents_by_end. */
+    struct extent *left, *right;        /* Children in extents_by_size. */
+    int height;                         /* Height of subtree in the tree. */
+  };
+
+static struct hash extents_by_start;
+static struct hash extents_by_end;
+static struct extent *extents_by_size;  /* Root of the AVL tree. */
+
+/* True if a release could not be recorded in the index for lack
+   of memory, so that the index must be rebuilt from free_map. */
+static bool index_stale;
+
+/* Statistics. */
+static unsigned long long alloc_cnt;    /* Allocations. */
+static unsigned long long probe_cnt;    /* Extents examined by them. */
+static uint64_t alloc_cycles;           /* CPU cycles spent in them. */
+
+static hash_hash_func extent_start_hash, extent_end_hash;
+static hash_less_func extent_start_less, extent_end_less;
+static void index_build (void);
+static bool index_insert (block_sector_t, size_t);
+static struct extent *index_best_fit (size_t);
+static struct extent *index_largest (void);
+static block_sector_t index_take (struct extent *, size_t);
+static struct extent *tree_insert (struct extent *, struct extent *);
+static struct extent *tree_remove (struct extent *, struct extent *);
 
 /* Initializes the free map. */
 void
@@ -17,36 +76,117 @@ free_map_init (void)
     PANIC ("bitmap creation failed--file system device is too large");
   bitmap_mark (free_map, FREE_MAP_SECTOR);
   bitmap_mark (free_map, ROOT_DIR_SECTOR);
+  lock_init (&free_map_lock, "free_map");
+
+  if (!hash_init (&extents_by_start, extent_start_hash, extent_start_less,
+                  NULL)
+      || !hash_init (&extents_by_end, extent_end_hash, extent_end_less,
+                     NULL))
+    PANIC ("can't allocate free extent index");
+  lock_acquire (&free_map_lock);
+  index_build ();
+  lock_release (&free_map_lock);
 }
 
 /* Allocates CNT consecutive sectors from the free map and stores
-   the first into *SECTORP.
+   the first into *SECTORP.  Picks the smallest run of free
+   sectors that is large enough, to keep large runs intact for
+   large requests.
    Returns true if successful, false if not enough consecutive
    sectors were available or if the free_map file could not be
    written. */
 bool
 free_map_allocate (size_t cnt, block_sector_t *sectorp)
 {
-  block_sector_t sector = bitmap_scan_and_flip (free_map, 0, cnt, false);
-  if (sector != BITMAP_ERROR
-      && free_map_file != NULL
-      && !bitmap_write (free_map, free_map_file))
+  struct extent *e;
+  block_sector_t sector = BITMAP_ERROR;
+  uint64_t start;
+
+  lock_acquire (&free_map_lock);
+  if (index_stale)
+    index_build ();
+  start = timer_cycles ();
+  alloc_cnt++;
+  e = index_best_fit (cnt);
+  alloc_cycles += timer_cycles () - start;
+  if (e != NULL)
     {
-      bitmap_set_multiple (free_map, sector, cnt, false); 
-      sector = BITMAP_ERROR;
+      sector = index_take (e, cnt);
+      bitmap_set_multiple (free_map, sector, cnt, true);
+      if (free_map_file != NULL
+          && !bitmap_write_range (free_map, free_map_file, sector, cnt))
+        {
+          bitmap_set_multiple (free_map, sector, cnt, false);
+          if (!index_insert (sector, cnt))
+            index_stale = true;
+          sector = BITMAP_ERROR;
+        }
     }
+  lock_release (&free_map_lock);
   if (sector != BITMAP_ERROR)
     *sectorp = sector;
   return sector != BITMAP_ERROR;
 }
 
+/* Allocates up to CNT consecutive sectors from the free map and
+   stores the first into *SECTORP.  Allocates CNT sectors, as
+   free_map_allocate() would, if possible, and otherwise the
+   largest run of free sectors there is.
+   Returns the number of sectors allocated, or 0 if the disk is
+   full or if the free_map file could not be written. */
+size_t
+free_map_allocate_some (size_t cnt, block_sector_t *sectorp)
+{
+  struct extent *e;
+  block_sector_t sector = BITMAP_ERROR;
+  uint64_t start;
+
+  ASSERT (cnt > 0);
+
+  lock_acquire (&free_map_lock);
+  if (index_stale)
+    index_build ();
+  start = timer_cycles ();
+  alloc_cnt++;
+  e = index_best_fit (cnt);
+  if (e == NULL)
+    {
+      e = index_largest ();
+      if (e != NULL)
+        cnt = e->cnt;
+    }
+  alloc_cycles += timer_cycles () - start;
+  if (e != NULL)
+    {
+      sector = index_take (e, cnt);
+      bitmap_set_multiple (free_map, sector, cnt, true);
+      if (free_map_file != NULL
+          && !bitmap_write_range (free_map, free_map_file, sector, cnt))
+        {
+          bitmap_set_multiple (free_map, sector, cnt, false);
+          if (!index_insert (sector, cnt))
+            index_stale = true;
+          sector = BITMAP_ERROR;
+        }
+    }
+  lock_release (&free_map_lock);
+  if (sector == BITMAP_ERROR)
+    return 0;
+  *sectorp = sector;
+  return cnt;
+}
+
 /* Makes CNT sectors starting at SECTOR available for use. */
 void
 free_map_release (block_sector_t sector, size_t cnt)
 {
+  lock_acquire (&free_map_lock);
   ASSERT (bitmap_all (free_map, sector, cnt));
   bitmap_set_multiple (free_map, sector, cnt, false);
-  bitmap_write (free_map, free_map_file);
+  bitmap_write_range (free_map, free_map_file, sector, cnt);
+  if (!index_stale && !index_insert (sector, cnt))
+    index_stale = true;
+  lock_release (&free_map_lock);
 }
 
 /* Opens the free map file and reads it from disk. */
@@ -58,12 +198,16 @@ free_map_open (void)
     PANIC ("can't open free map");
   if (!bitmap_read (free_map, free_map_file))
     PANIC ("can't read free map");
+  lock_acquire (&free_map_lock);
+  index_build ();
+  lock_release (&free_map_lock);
 }
 
 /* Writes the free map to disk and closes the free map file. */
 void
 free_map_close (void) 
 {
+  file_flush (free_map_file);
   file_close (free_map_file);
 }
 
@@ -73,7 +217,7 @@ void
 free_map_create (void) 
 {
   /* Create inode. */
-  if (!inode_create (FREE_MAP_SECTOR, bitmap_file_size (free_map)))
+  if (!inode_create (FREE_MAP_SECTOR, bitmap_file_size (free_map), false))
     PANIC ("free map creation failed");
 
   /* Write bitmap to file. */
@@ -83,3 +227,347 @@ free_map_create (void)
   if (!bitmap_write (free_map, free_map_file))
     PANIC ("can't write free map");
 }
+
+/* Prints free map statistics.  The cycle count covers only the
+   search for a free extent, not the update of the bitmap or its
+   file, which costs the same whatever the search. */
+void
+free_map_print_stats (void)
+{
+  printf ("Free map: %llu allocations, %llu extents examined, "
+          "%llu cycles average search\n",
+          alloc_cnt, probe_cnt,
+          alloc_cnt > 0 ? alloc_cycles / alloc_cnt : 0);
+}
+
+/* Returns a hash value for the first sector of extent E. */
+static unsigned
+extent_start_hash (const struct hash_elem *e, void *aux UNUSED)
+{
+  return hash_int (hash_entry (e, struct extent, start_elem)->start);
+}
+
+/* Returns true if extent A starts before extent B. */
+static bool
+extent_start_less (const struct hash_elem *a, const struct hash_elem *b,
+                   void *aux UNUSED)
+{
+  return (hash_entry (a, struct extent, start_elem)->start
+          < hash_entry (b, struct extent, start_elem)->start);
+}
+
+/* Returns a hash value for the sector just past extent E. */
+static unsigned
+extent_end_hash (const struct hash_elem *e_, void *aux UNUSED)
+{
+  const struct extent *e = hash_entry (e_, struct extent, end_elem);
+  return hash_int (e->start + e->cnt);
+}
+
+/* Returns true if extent A ends before extent B. */
+static bool
+extent_end_less (const struct hash_elem *a_, const struct hash_elem *b_,
+                 void *aux UNUSED)
+{
+  const struct extent *a = hash_entry (a_, struct extent, end_elem);
+  const struct extent *b = hash_entry (b_, struct extent, end_elem);
+  return a->start + a->cnt < b->start + b->cnt;
+}
+
+/* Adds E to the index. */
+static void
+extent_link (struct extent *e)
+{
+  hash_insert (&extents_by_start, &e->start_elem);
+  hash_insert (&extents_by_end, &e->end_elem);
+  extents_by_size = tree_insert (extents_by_size, e);
+}
+
+/* Removes E from the index, so that its bounds may change. */
+static void
+extent_unlink (struct extent *e)
+{
+  hash_delete (&extents_by_start, &e->start_elem);
+  hash_delete (&extents_by_end, &e->end_elem);
+  extents_by_size = tree_remove (extents_by_size, e);
+}
+
+/* Frees extent E, which must not be in the index. */
+static void
+extent_free (struct hash_elem *e, void *aux UNUSED)
+{
+  free (hash_entry (e, struct extent, start_elem));
+}
+
+/* Rebuilds the index from free_map.  Panics if memory runs out,
+   since the file system cannot allocate sectors without it. */
+static void
+index_build (void)
+{
+  size_t size = bitmap_size (free_map);
+  size_t start, end;
+
+  ASSERT (lock_held_by_current_thread (&free_map_lock));
+
+  hash_clear (&extents_by_end, NULL);
+  hash_clear (&extents_by_start, extent_free);
+  extents_by_size = NULL;
+  index_stale = false;
+
+  for (start = bitmap_scan (free_map, 0, 1, false);
+       start != BITMAP_ERROR;
+       start = end < size ? bitmap_scan (free_map, end, 1, false) : BITMAP_ERROR)
+    {
+      end = bitmap_scan (free_map, start, 1, true);
+      if (end == BITMAP_ERROR)
+        end = size;
+      if (!index_insert (start, end - start))
+        PANIC ("can't allocate free extent index");
+    }
+}
+
+/* Records that the CNT sectors starting at SECTOR are free,
+   merging them with any adjacent free extents.  Returns false if
+   memory runs out. */
+static bool
+index_insert (block_sector_t sector, size_t cnt)
+{
+  struct extent key, *prev = NULL, *next = NULL;
+  struct hash_elem *e;
+
+  ASSERT (lock_held_by_current_thread (&free_map_lock));
+
+  /* Find the extents that end at SECTOR and that start just past
+     the new run. */
+  key.start = sector;
+  key.cnt = 0;
+  e = hash_find (&extents_by_end, &key.end_elem);
+  if (e != NULL)
+    prev = hash_entry (e, struct extent, end_elem);
+  key.start = sector + cnt;
+  e = hash_find (&extents_by_start, &key.start_elem);
+  if (e != NULL)
+    next = hash_entry (e, struct extent, start_elem);
+
+  if (prev != NULL)
+    {
+      extent_unlink (prev);
+      prev->cnt += cnt;
+      if (next != NULL)
+        {
+          extent_unlink (next);
+          prev->cnt += next->cnt;
+          free (next);
+        }
+      extent_link (prev);
+    }
+  else if (next != NULL)
+    {
+      extent_unlink (next);
+      next->start = sector;
+      next->cnt += cnt;
+      extent_link (next);
+    }
+  else
+    {
+      struct extent *new = malloc (sizeof *new);
+      if (new == NULL)
+        return false;
+      new->start = sector;
+      new->cnt = cnt;
+      extent_link (new);
+    }
+  return true;
+}
+
+/* Returns the smallest free extent of at least CNT sectors, the
+   lowest-numbered one among equals, or a null pointer if there is
+   none. */
+static struct extent *
+index_best_fit (size_t cnt)
+{
+  struct extent *best = NULL;
+  struct extent *e = extents_by_size;
+
+  while (e != NULL)
+    {
+      probe_cnt++;
+      if (e->cnt >= cnt)
+        {
+          best = e;
+          e = e->left;
+        }
+      else
+        e = e->right;
+    }
+  return best;
+}
+
+/* Returns the largest free extent, or a null pointer if the disk
+   is full. */
+static struct extent *
+index_largest (void)
+{
+  struct extent *e = extents_by_size;
+
+  if (e != NULL)
+    for (probe_cnt++; e->right != NULL; probe_cnt++)
+      e = e->right;
+  return e;
+}
+
+/* Removes the first CNT sectors of extent E from the index and
+   returns the first of them. */
+static block_sector_t
+index_take (struct extent *e, size_t cnt)
+{
+  block_sector_t sector = e->start;
+
+  ASSERT (cnt > 0 && cnt <= e->cnt);
+
+  extent_unlink (e);
+  if (cnt == e->cnt)
+    free (e);
+  else
+    {
+      e->start += cnt;
+      e->cnt -= cnt;
+      extent_link (e);
+    }
+  return sector;
+}
+
+/* AVL tree of extents, ordered by size and then by first sector. */
+
+/* Returns the height of the subtree rooted at E. */
+static int
+tree_height (const struct extent *e)
+{
+  return e != NULL ? e->height : 0;
+}
+
+/* Recomputes E's height from its children's. */
+static void
+tree_update (struct extent *e)
+{
+  int left = tree_height (e->left);
+  int right = tree_height (e->right);
+
+  e->height = (left > right ? left : right) + 1;
+}
+
+/* Rotates the subtree rooted at E to the right and returns its
+   new root. */
+static struct extent *
+tree_rotate_right (struct extent *e)
+{
+  struct extent *root = e->left;
+
+  e->left = root->right;
+  root->right = e;
+  tree_update (e);
+  tree_update (root);
+  return root;
+}
+
+/* Rotates the subtree rooted at E to the left and returns its
+   new root. */
+static struct extent *
+tree_rotate_left (struct extent *e)
+{
+  struct extent *root = e->right;
+
+  e->right = root->left;
+  root->left = e;
+  tree_update (e);
+  tree_update (root);
+  return root;
+}
+
+/* Restores the AVL balance of the subtree rooted at E, whose
+   children are balanced and differ in height by at most 2, and
+   returns its new root. */
+static struct extent *
+tree_balance (struct extent *e)
+{
+  int balance = tree_height (e->left) - tree_height (e->right);
+
+  if (balance > 1)
+    {
+      if (tree_height (e->left->left) < tree_height (e->left->right))
+        e->left = tree_rotate_left (e->left);
+      return tree_rotate_right (e);
+    }
+  else if (balance < -1)
+    {
+      if (tree_height (e->right->right) < tree_height (e->right->left))
+        e->right = tree_rotate_right (e->right);
+      return tree_rotate_left (e);
+    }
+  tree_update (e);
+  return e;
+}
+
+/* Returns true if extent A sorts before extent B in the tree. */
+static bool
+tree_less (const struct extent *a, const struct extent *b)
+{
+  return a->cnt != b->cnt ? a->cnt < b->cnt : a->start < b->start;
+}
+
+/* Inserts E into the subtree rooted at ROOT and returns the
+   subtree's new root. */
+static struct extent *
+tree_insert (struct extent *root, struct extent *e)
+{
+  if (root == NULL)
+    {
+      e->left = e->right = NULL;
+      e->height = 1;
+      return e;
+    }
+  if (tree_less (e, root))
+    root->left = tree_insert (root->left, e);
+  else
+    root->right = tree_insert (root->right, e);
+  return tree_balance (root);
+}
+
+/* Removes the smallest extent from the nonempty subtree rooted at
+   ROOT, stores it in *MIN, and returns the subtree's new root. */
+static struct extent *
+tree_remove_min (struct extent *root, struct extent **min)
+{
+  if (root->left == NULL)
+    {
+      *min = root;
+      return root->right;
+    }
+  root->left = tree_remove_min (root->left, min);
+  return tree_balance (root);
+}
+
+/* Removes E, which must be in the subtree rooted at ROOT, and
+   returns the subtree's new root. */
+static struct extent *
+tree_remove (struct extent *root, struct extent *e)
+{
+  ASSERT (root != NULL);
+
+  if (root == e)
+    {
+      struct extent *min, *right;
+
+      if (e->right == NULL)
+        return e->left;
+      right = tree_remove_min (e->right, &min);
+      min->left = e->left;
+      min->right = right;
+      return tree_balance (min);
+    }
+  if (tree_less (e, root))
+    root->left = tree_remove (root->left, e);
+  else
+    root->right = tree_remove (root->right, e);
+  return tree_balance (root);
+}
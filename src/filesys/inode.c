@@ -1,23 +1,46 @@
 #include "filesys/inode.h"
-#include <list.h>
+#include <hash.h>
 #include <debug.h>
 #include <round.h>
 #include <string.h>
+#include "filesys/cache.h"
 #include "filesys/filesys.h"
 #include "filesys/free-map.h"
 #include "threads/malloc.h"
+#include "threads/synch.h"
+#include "threads/vaddr.h"
 
 /* Identifies an inode. */
 #define INODE_MAGIC 0x494e4f44
 
+/* Number of direct sector pointers in an inode. */
+#define DIRECT_CNT 123
+
+/* Number of sector pointers in an indirect block. */
+#define PTRS_PER_SECTOR (BLOCK_SECTOR_SIZE / sizeof (block_sector_t))
+
+/* Maximum number of data sectors in a file. */
+#define INODE_MAX_SECTORS \
+  (DIRECT_CNT + PTRS_PER_SECTOR + PTRS_PER_SECTOR * PTRS_PER_SECTOR)
+
 /* On-disk inode.
-   Must be exactly BLOCK_SECTOR_SIZE bytes long. */
+   Must be exactly BLOCK_SECTOR_SIZE bytes long.
+
+   Data sector N of the file is DIRECT[N] for the first
+   DIRECT_CNT sectors.  The next PTRS_PER_SECTOR sectors are
+   listed in the indirect block, and the rest in the indirect
+   blocks listed in the doubly indirect block.  A pointer of 0
+   (the free map's sector, never a data sector) means that the
+   sector or index block is not allocated; every sector below
+   LENGTH is allocated. */
 struct inode_disk
   {
-    block_sector_t start;               /* First data sector. */
+    block_sector_t direct[DIRECT_CNT];  /* Direct data sectors. */
+    block_sector_t indirect;            /* Indirect block. */
+    block_sector_t doubly_indirect;     /* Doubly indirect block. */
     off_t length;                       /* File size in bytes. */
     unsigned magic;                     /* Magic number. */
-    uint32_t unused[125];               /* Not used. */
+    uint32_t is_dir;                    /* Nonzero for a directory. */
   };
 
 /* Returns the number of sectors to allocate for an inode SIZE
@@ -31,49 +54,289 @@ bytes_to_sectors (off_t size)
 /* In-memory inode. */
 struct inode 
   {
-    struct list_elem elem;              /* Element in inode list. */
+    struct hash_elem elem;              /* Element in open_inodes. */
     block_sector_t sector;              /* Sector number of disk location. */
     int open_cnt;                       /* Number of openers. */
     bool removed;                       /* True if deleted, false otherwise. */
     int deny_write_cnt;                 /* 0: writes ok, >0: deny writes. */
+    struct lock lock;                   /* Protects data and deny_write_cnt. */
+    struct rwlock dir_lock;             /* Orders directory changes. */
+    off_t ra_next;                      /* Where a sequential read resumes. */
+    size_t ra_depth;                    /* Sectors to read ahead. */
+    size_t ra_end;                      /* Sector index read ahead up to. */
+    size_t leaf_idx;                    /* Indirect block last used... */
+    block_sector_t leaf_sector;         /* ...and its sector. */
+    size_t sector_cnt;                  /* Data sectors allocated. */
     struct inode_disk data;             /* Inode content. */
   };
 
+/* Value of leaf_idx when no indirect block has been used. */
+#define NO_LEAF ((size_t) -1)
+
+/* A sector's worth of zeros. */
+static char zeros[BLOCK_SECTOR_SIZE];
+
+/* Allocates a sector, fills it with zeros, and stores its number
+   in *SECTORP.  Returns true if successful, false if the disk is
+   full. */
+static bool
+allocate_zeroed (block_sector_t *sectorp)
+{
+  if (!free_map_allocate (1, sectorp))
+    return false;
+  cache_write (*sectorp, zeros);
+  return true;
+}
+
+/* Returns the indirect block that holds the pointer to INODE's
+   data sector N, which must be at least DIRECT_CNT, and stores
+   the pointer's index within the block in *SLOT.  If the block
+   does not exist, allocates it if ALLOCATE is true and returns 0
+   otherwise, or if allocation fails.
+
+   The block last used is remembered in INODE, so that a
+   sequential pass reads the doubly indirect block only once per
+   PTRS_PER_SECTOR sectors.  INODE's lock must be held. */
+static block_sector_t
+indirect_block (struct inode *inode, size_t n, size_t *slot, bool allocate)
+{
+  struct inode_disk *disk = &inode->data;
+  block_sector_t leaf;
+  size_t leaf_idx;
+
+  n -= DIRECT_CNT;
+  if (n < PTRS_PER_SECTOR)
+    {
+      leaf_idx = 0;
+      *slot = n;
+    }
+  else
+    {
+      n -= PTRS_PER_SECTOR;
+      leaf_idx = 1 + n / PTRS_PER_SECTOR;
+      *slot = n % PTRS_PER_SECTOR;
+    }
+  if (leaf_idx == inode->leaf_idx)
+    return inode->leaf_sector;
+
+  if (leaf_idx == 0)
+    {
+      if (disk->indirect == 0
+          && (!allocate || !allocate_zeroed (&disk->indirect)))
+        return 0;
+      leaf = disk->indirect;
+    }
+  else
+    {
+      size_t ofs = (leaf_idx - 1) * sizeof leaf;
+
+      if (disk->doubly_indirect == 0
+          && (!allocate || !allocate_zeroed (&disk->doubly_indirect)))
+        return 0;
+      cache_read_at (disk->doubly_indirect, &leaf, ofs, sizeof leaf);
+      if (leaf == 0)
+        {
+          if (!allocate || !allocate_zeroed (&leaf))
+            return 0;
+          cache_write_at (disk->doubly_indirect, &leaf, ofs, sizeof leaf);
+        }
+    }
+
+  inode->leaf_idx = leaf_idx;
+  inode->leaf_sector = leaf;
+  return leaf;
+}
+
 /* Returns the block device sector that contains byte offset POS
    within INODE.
-   Returns -1 if INODE does not contain data for a byte at offset
-   POS. */
+   Returns -1 if INODE has no data sector allocated for a byte at
+   offset POS.  That sector may lie past the end of file while a
+   write that extends INODE is in progress.  INODE's lock must
+   be held. */
 static block_sector_t
-byte_to_sector (const struct inode *inode, off_t pos) 
+byte_to_sector (struct inode *inode, off_t pos) 
 {
+  size_t n = pos / BLOCK_SECTOR_SIZE;
+  block_sector_t leaf, sector;
+  size_t slot;
+
   ASSERT (inode != NULL);
-  if (pos < inode->data.length)
-    return inode->data.start + pos / BLOCK_SECTOR_SIZE;
-  else
+  ASSERT (lock_held_by_current_thread (&inode->lock));
+
+  if (n >= inode->sector_cnt)
     return -1;
+  if (n < DIRECT_CNT)
+    return inode->data.direct[n];
+
+  leaf = indirect_block (inode, n, &slot, false);
+  ASSERT (leaf != 0);
+  cache_read_at (leaf, &sector, slot * sizeof sector, sizeof sector);
+  return sector;
+}
+
+/* Fills SECTOR, which the caller has allocated, with zeros and
+   makes it INODE's data sector N, allocating any indirect blocks
+   needed to reach it.  Returns true if successful, false if the
+   disk is full.  INODE's lock must be held. */
+static bool
+add_sector (struct inode *inode, size_t n, block_sector_t sector)
+{
+  block_sector_t leaf;
+  size_t slot;
+
+  if (n < DIRECT_CNT)
+    inode->data.direct[n] = sector;
+  else
+    {
+      leaf = indirect_block (inode, n, &slot, true);
+      if (leaf == 0)
+        return false;
+      cache_write_at (leaf, &sector, slot * sizeof sector, sizeof sector);
+    }
+  cache_write (sector, zeros);
+  return true;
 }
 
-/* List of open inodes, so that opening a single inode twice
-   returns the same `struct inode'. */
-static struct list open_inodes;
+/* Allocates the sectors that INODE needs to hold LENGTH bytes.
+   The new sectors read as zeros.  If the disk fills up, keeps the
+   sectors allocated so far.  Returns true if INODE has room for
+   LENGTH bytes, false otherwise.  INODE's length does not change
+   until the caller calls set_length().  INODE's lock must be
+   held.
+
+   The new data sectors are allocated as few runs of consecutive
+   sectors as the free map can provide, so that a file written
+   sequentially usually lies sequentially on disk. */
+static bool
+extend (struct inode *inode, off_t length)
+{
+  size_t need = bytes_to_sectors (length);
+  bool success = need <= INODE_MAX_SECTORS;
+  block_sector_t run = 0;
+  size_t run_cnt = 0;
+
+  ASSERT (lock_held_by_current_thread (&inode->lock));
+
+  if (!success)
+    need = INODE_MAX_SECTORS;
+  for (; inode->sector_cnt < need; inode->sector_cnt++)
+    {
+      if (run_cnt == 0)
+        run_cnt = free_map_allocate_some (need - inode->sector_cnt, &run);
+      if (run_cnt == 0 || !add_sector (inode, inode->sector_cnt, run))
+        {
+          success = false;
+          break;
+        }
+      run++;
+      run_cnt--;
+    }
+  if (run_cnt > 0)
+    free_map_release (run, run_cnt);
+  return success;
+}
+
+/* Grows INODE's length to LENGTH bytes, which extend() must have
+   made room for, and writes INODE to the cache.  Does nothing if
+   INODE is already at least that long.  INODE's lock must be
+   held. */
+static void
+set_length (struct inode *inode, off_t length)
+{
+  ASSERT (lock_held_by_current_thread (&inode->lock));
+  ASSERT (bytes_to_sectors (length) <= inode->sector_cnt);
+
+  if (length > inode->data.length)
+    {
+      inode->data.length = length;
+      cache_write (inode->sector, &inode->data);
+    }
+}
+
+/* Releases INODE's data sectors and index blocks, but not the
+   inode sector itself, to the free map. */
+static void
+deallocate (struct inode *inode)
+{
+  struct inode_disk *disk = &inode->data;
+  size_t i;
+
+  lock_acquire (&inode->lock);
+  for (i = 0; i < inode->sector_cnt; i++)
+    free_map_release (byte_to_sector (inode, i * BLOCK_SECTOR_SIZE), 1);
+
+  /* Index blocks may exist past the last data sector, left over
+     from a growth that ran out of space. */
+  if (disk->indirect != 0)
+    free_map_release (disk->indirect, 1);
+  if (disk->doubly_indirect != 0)
+    {
+      for (i = 0; i < PTRS_PER_SECTOR; i++)
+        {
+          block_sector_t leaf;
+          cache_read_at (disk->doubly_indirect, &leaf, i * sizeof leaf,
+                         sizeof leaf);
+          if (leaf != 0)
+            free_map_release (leaf, 1);
+        }
+      free_map_release (disk->doubly_indirect, 1);
+    }
+  lock_release (&inode->lock);
+}
+
+/* Maximum number of sectors to read ahead of a sequential
+   reader. */
+#define READ_AHEAD_MAX 16
+
+/* Open inodes, hashed by sector number, so that opening a single
+   inode twice returns the same `struct inode'. */
+static struct hash open_inodes;
+
+/* Protects open_inodes and the open_cnt of every inode in it. */
+static struct lock open_inodes_lock;
+
+static hash_hash_func inode_hash;
+static hash_less_func inode_less;
 
 /* Initializes the inode module. */
 void
 inode_init (void) 
 {
-  list_init (&open_inodes);
+  if (!hash_init (&open_inodes, inode_hash, inode_less, NULL))
+    PANIC ("can't allocate open inode table");
+  lock_init (&open_inodes_lock, "open_inodes");
+}
+
+/* Returns a hash value for the inode containing E. */
+static unsigned
+inode_hash (const struct hash_elem *e, void *aux UNUSED)
+{
+  const struct inode *inode = hash_entry (e, struct inode, elem);
+  return hash_int (inode->sector);
+}
+
+/* Returns true if the inode containing A precedes the one
+   containing B in sector order. */
+static bool
+inode_less (const struct hash_elem *a, const struct hash_elem *b,
+            void *aux UNUSED)
+{
+  return (hash_entry (a, struct inode, elem)->sector
+          < hash_entry (b, struct inode, elem)->sector);
 }
 
 /* Initializes an inode with LENGTH bytes of data and
    writes the new inode to sector SECTOR on the file system
-   device.
+   device.  The inode is marked as a directory if IS_DIR is
+   true.
    Returns true if successful.
    Returns false if memory or disk allocation fails. */
 bool
-inode_create (block_sector_t sector, off_t length)
+inode_create (block_sector_t sector, off_t length, bool is_dir)
 {
   struct inode_disk *disk_inode = NULL;
-  bool success = false;
+  struct inode *inode;
+  bool success;
 
   ASSERT (length >= 0);
 
@@ -82,26 +345,26 @@ inode_create (block_sector_t sector, off_t length)
   ASSERT (sizeof *disk_inode == BLOCK_SECTOR_SIZE);
 
   disk_inode = calloc (1, sizeof *disk_inode);
-  if (disk_inode != NULL)
-    {
-      size_t sectors = bytes_to_sectors (length);
-      disk_inode->length = length;
-      disk_inode->magic = INODE_MAGIC;
-      if (free_map_allocate (sectors, &disk_inode->start)) 
-        {
-          block_write (fs_device, sector, disk_inode);
-          if (sectors > 0) 
-            {
-              static char zeros[BLOCK_SECTOR_SIZE];
-              size_t i;
-              
-              for (i = 0; i < sectors; i++) 
-                block_write (fs_device, disk_inode->start + i, zeros);
-            }
-          success = true; 
-        } 
-      free (disk_inode);
-    }
+  if (disk_inode == NULL)
+    return false;
+  disk_inode->length = 0;
+  disk_inode->magic = INODE_MAGIC;
+  disk_inode->is_dir = is_dir;
+  cache_write (sector, disk_inode);
+  free (disk_inode);
+
+  /* Grow the empty inode to LENGTH. */
+  inode = inode_open (sector);
+  if (inode == NULL)
+    return false;
+  lock_acquire (&inode->lock);
+  success = extend (inode, length);
+  if (success)
+    set_length (inode, length);
+  lock_release (&inode->lock);
+  if (!success)
+    deallocate (inode);
+  inode_close (inode);
   return success;
 }
 
@@ -111,33 +374,49 @@ inode_create (block_sector_t sector, off_t length)
 struct inode *
 inode_open (block_sector_t sector)
 {
-  struct list_elem *e;
+  /* Lookup key.  Too big for the stack, so it is static and,
+     like open_inodes, protected by open_inodes_lock. */
+  static struct inode key;
+  struct hash_elem *e;
   struct inode *inode;
 
-  /* Check whether this inode is already open. */
-  for (e = list_begin (&open_inodes); e != list_end (&open_inodes);
-       e = list_next (e)) 
+  /* Check whether this inode is already open.  The lock is held
+     until a new inode has been read in, so that no other opener
+     can find it half-initialized. */
+  lock_acquire (&open_inodes_lock);
+  key.sector = sector;
+  e = hash_find (&open_inodes, &key.elem);
+  if (e != NULL)
     {
-      inode = list_entry (e, struct inode, elem);
-      if (inode->sector == sector) 
-        {
-          inode_reopen (inode);
-          return inode; 
-        }
+      inode = hash_entry (e, struct inode, elem);
+      inode->open_cnt++;
+      lock_release (&open_inodes_lock);
+      return inode; 
     }
 
   /* Allocate memory. */
   inode = malloc (sizeof *inode);
   if (inode == NULL)
-    return NULL;
+    {
+      lock_release (&open_inodes_lock);
+      return NULL;
+    }
 
   /* Initialize. */
-  list_push_front (&open_inodes, &inode->elem);
   inode->sector = sector;
+  hash_insert (&open_inodes, &inode->elem);
   inode->open_cnt = 1;
   inode->deny_write_cnt = 0;
   inode->removed = false;
-  block_read (fs_device, inode->sector, &inode->data);
+  inode->ra_next = 0;
+  inode->ra_depth = 0;
+  inode->ra_end = 0;
+  inode->leaf_idx = NO_LEAF;
+  lock_init (&inode->lock, "inode");
+  rwlock_init (&inode->dir_lock, "dir", true);
+  cache_read (inode->sector, &inode->data);
+  inode->sector_cnt = bytes_to_sectors (inode->data.length);
+  lock_release (&open_inodes_lock);
   return inode;
 }
 
@@ -146,10 +425,28 @@ struct inode *
 inode_reopen (struct inode *inode)
 {
   if (inode != NULL)
-    inode->open_cnt++;
+    {
+      lock_acquire (&open_inodes_lock);
+      inode->open_cnt++;
+      lock_release (&open_inodes_lock);
+    }
   return inode;
 }
 
+/* Returns true if INODE is a directory. */
+bool
+inode_is_dir (const struct inode *inode)
+{
+  return inode->data.is_dir != 0;
+}
+
+/* Returns true if INODE has been removed. */
+bool
+inode_is_removed (const struct inode *inode)
+{
+  return inode->removed;
+}
+
 /* Returns INODE's inode number. */
 block_sector_t
 inode_get_inumber (const struct inode *inode)
@@ -163,22 +460,26 @@ inode_get_inumber (const struct inode *inode)
 void
 inode_close (struct inode *inode) 
 {
+  bool last;
+
   /* Ignore null pointer. */
   if (inode == NULL)
     return;
 
+  lock_acquire (&open_inodes_lock);
+  last = --inode->open_cnt == 0;
+  if (last)
+    hash_delete (&open_inodes, &inode->elem);
+  lock_release (&open_inodes_lock);
+
   /* Release resources if this was the last opener. */
-  if (--inode->open_cnt == 0)
+  if (last)
     {
-      /* Remove from inode list and release lock. */
-      list_remove (&inode->elem);
- 
       /* Deallocate blocks if removed. */
       if (inode->removed) 
         {
+          deallocate (inode);
           free_map_release (inode->sector, 1);
-          free_map_release (inode->data.start,
-                            bytes_to_sectors (inode->data.length)); 
         }
 
       free (inode); 
@@ -194,6 +495,42 @@ inode_remove (struct inode *inode)
   inode->removed = true;
 }
 
+/* Notes that bytes START through END (exclusive) of INODE were
+   just read.  Each read that picks up where the previous one left
+   off doubles the number of sectors to read ahead, up to
+   READ_AHEAD_MAX, and any other read halves it.  Then asks the
+   buffer cache to fetch that many sectors past END in the
+   background, skipping those already requested. */
+static void
+read_ahead (struct inode *inode, off_t start, off_t end)
+{
+  size_t next = DIV_ROUND_UP (end, BLOCK_SECTOR_SIZE);
+  size_t sectors, first, last, i;
+
+  lock_acquire (&inode->lock);
+  sectors = bytes_to_sectors (inode->data.length);
+  if (start != inode->ra_next)
+    {
+      inode->ra_depth /= 2;
+      inode->ra_end = 0;
+    }
+  else if (inode->ra_depth == 0)
+    inode->ra_depth = 1;
+  else if (inode->ra_depth < READ_AHEAD_MAX)
+    inode->ra_depth *= 2;
+  inode->ra_next = end;
+
+  first = next > inode->ra_end ? next : inode->ra_end;
+  last = next + inode->ra_depth;
+  if (last > sectors)
+    last = sectors;
+  for (i = first; i < last; i++)
+    cache_read_ahead (byte_to_sector (inode, i * BLOCK_SECTOR_SIZE));
+  if (last > inode->ra_end)
+    inode->ra_end = last;
+  lock_release (&inode->lock);
+}
+
 /* Reads SIZE bytes from INODE into BUFFER, starting at position OFFSET.
    Returns the number of bytes actually read, which may be less
    than SIZE if an error occurs or end of file is reached. */
@@ -201,111 +538,139 @@ off_t
 inode_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset) 
 {
   uint8_t *buffer = buffer_;
-  off_t bytes_read = 0;
   uint8_t *bounce = NULL;
+  off_t bytes_read = 0;
+
+  /* A user buffer is filled from BOUNCE after the cache entry is
+     released, because touching it may fault, and evicting a page
+     for the fault may need the same entry or the disk. */
+  if (is_user_vaddr (buffer) && size > 0)
+    {
+      bounce = malloc (BLOCK_SECTOR_SIZE);
+      if (bounce == NULL)
+        return 0;
+    }
 
   while (size > 0) 
     {
       /* Disk sector to read, starting byte offset within sector. */
-      block_sector_t sector_idx = byte_to_sector (inode, offset);
+      block_sector_t sector_idx;
       int sector_ofs = offset % BLOCK_SECTOR_SIZE;
 
       /* Bytes left in inode, bytes left in sector, lesser of the two. */
-      off_t inode_left = inode_length (inode) - offset;
+      off_t inode_left;
       int sector_left = BLOCK_SECTOR_SIZE - sector_ofs;
-      int min_left = inode_left < sector_left ? inode_left : sector_left;
+      int min_left;
 
       /* Number of bytes to actually copy out of this sector. */
-      int chunk_size = size < min_left ? size : min_left;
+      int chunk_size;
+
+      lock_acquire (&inode->lock);
+      sector_idx = byte_to_sector (inode, offset);
+      inode_left = inode->data.length - offset;
+      lock_release (&inode->lock);
+
+      min_left = inode_left < sector_left ? inode_left : sector_left;
+      chunk_size = size < min_left ? size : min_left;
       if (chunk_size <= 0)
         break;
 
-      if (sector_ofs == 0 && chunk_size == BLOCK_SECTOR_SIZE)
+      if (bounce != NULL)
         {
-          /* Read full sector directly into caller's buffer. */
-          block_read (fs_device, sector_idx, buffer + bytes_read);
-        }
-      else 
-        {
-          /* Read sector into bounce buffer, then partially copy
-             into caller's buffer. */
-          if (bounce == NULL) 
-            {
-              bounce = malloc (BLOCK_SECTOR_SIZE);
-              if (bounce == NULL)
-                break;
-            }
-          block_read (fs_device, sector_idx, bounce);
-          memcpy (buffer + bytes_read, bounce + sector_ofs, chunk_size);
+          cache_read_at (sector_idx, bounce, sector_ofs, chunk_size);
+          memcpy (buffer + bytes_read, bounce, chunk_size);
         }
+      else
+        cache_read_at (sector_idx, buffer + bytes_read, sector_ofs,
+                       chunk_size);
       
       /* Advance. */
       size -= chunk_size;
       offset += chunk_size;
       bytes_read += chunk_size;
     }
+
   free (bounce);
 
+  if (bytes_read > 0)
+    read_ahead (inode, offset - bytes_read, offset);
+
   return bytes_read;
 }
 
 /* Writes SIZE bytes from BUFFER into INODE, starting at OFFSET.
    Returns the number of bytes actually written, which may be
-   less than SIZE if end of file is reached or an error occurs.
-   (Normally a write at end of file would extend the inode, but
-   growth is not yet implemented.) */
+   less than SIZE if the disk fills up or an error occurs.
+   A write past end of file extends the inode, allocating the
+   sectors it needs; any gap before OFFSET reads as zeros.  The
+   new length takes effect only once the data has been copied, so
+   that a concurrent reader never sees the new bytes as zeros. */
 off_t
 inode_write_at (struct inode *inode, const void *buffer_, off_t size,
                 off_t offset) 
 {
   const uint8_t *buffer = buffer_;
-  off_t bytes_written = 0;
   uint8_t *bounce = NULL;
+  off_t bytes_written = 0;
+  bool denied, extending = false;
 
-  if (inode->deny_write_cnt)
-    return 0;
+  /* The lock is not held while copying, because BUFFER may be a
+     user page whose fault-in evicts a page mapped from INODE.
+     For the same reason, a user buffer is copied into BOUNCE
+     before any cache entry is taken. */
+  if (is_user_vaddr (buffer) && size > 0)
+    {
+      bounce = malloc (BLOCK_SECTOR_SIZE);
+      if (bounce == NULL)
+        return 0;
+    }
+
+  lock_acquire (&inode->lock);
+  denied = inode->deny_write_cnt > 0;
+  if (!denied && size > 0 && offset + size > inode->data.length)
+    {
+      extend (inode, offset + size);
+      extending = true;
+    }
+  lock_release (&inode->lock);
+  if (denied)
+    {
+      free (bounce);
+      return 0;
+    }
 
   while (size > 0) 
     {
       /* Sector to write, starting byte offset within sector. */
-      block_sector_t sector_idx = byte_to_sector (inode, offset);
+      block_sector_t sector_idx;
       int sector_ofs = offset % BLOCK_SECTOR_SIZE;
 
       /* Bytes left in inode, bytes left in sector, lesser of the two. */
-      off_t inode_left = inode_length (inode) - offset;
+      off_t inode_left;
       int sector_left = BLOCK_SECTOR_SIZE - sector_ofs;
-      int min_left = inode_left < sector_left ? inode_left : sector_left;
+      int min_left;
 
       /* Number of bytes to actually write into this sector. */
-      int chunk_size = size < min_left ? size : min_left;
+      int chunk_size;
+
+      lock_acquire (&inode->lock);
+      sector_idx = byte_to_sector (inode, offset);
+      inode_left = (off_t) (inode->sector_cnt * BLOCK_SECTOR_SIZE) - offset;
+      lock_release (&inode->lock);
+
+      min_left = inode_left < sector_left ? inode_left : sector_left;
+      chunk_size = size < min_left ? size : min_left;
       if (chunk_size <= 0)
         break;
 
-      if (sector_ofs == 0 && chunk_size == BLOCK_SECTOR_SIZE)
+      if (bounce != NULL)
         {
-          /* Write full sector directly to disk. */
-          block_write (fs_device, sector_idx, buffer + bytes_written);
-        }
-      else 
-        {
-          /* We need a bounce buffer. */
-          if (bounce == NULL) 
-            {
-              bounce = malloc (BLOCK_SECTOR_SIZE);
-              if (bounce == NULL)
-                break;
-            }
-
-          /* If the sector contains data before or after the chunk
-             we're writing, then we need to read in the sector
-             first.  Otherwise we start with a sector of all zeros. */
-          if (sector_ofs > 0 || chunk_size < sector_left) 
-            block_read (fs_device, sector_idx, bounce);
-          else
-            memset (bounce, 0, BLOCK_SECTOR_SIZE);
-          memcpy (bounce + sector_ofs, buffer + bytes_written, chunk_size);
-          block_write (fs_device, sector_idx, bounce);
+          memcpy (bounce, buffer + bytes_written, chunk_size);
+          cache_write_at (sector_idx, bounce, sector_ofs, chunk_size);
         }
+      else
+        cache_write_at (sector_idx, buffer + bytes_written, sector_ofs,
+                        chunk_size);
 
       /* Advance. */
       size -= chunk_size;
@@ -314,6 +679,19 @@ inode_write_at (struct inode *inode, const void *buffer_, off_t size,
     }
   free (bounce);
 
+  /* Publish the new length.  If the disk filled up before the
+     write reached OFFSET, the sectors allocated for the gap still
+     join the file, as zeros, rather than leak. */
+  if (extending)
+    {
+      off_t room;
+
+      lock_acquire (&inode->lock);
+      room = inode->sector_cnt * BLOCK_SECTOR_SIZE;
+      set_length (inode, offset < room ? offset : room);
+      lock_release (&inode->lock);
+    }
+
   return bytes_written;
 }
 
@@ -322,8 +700,10 @@ inode_write_at (struct inode *inode, const void *buffer_, off_t size,
 void
 inode_deny_write (struct inode *inode) 
 {
+  lock_acquire (&inode->lock);
   inode->deny_write_cnt++;
   ASSERT (inode->deny_write_cnt <= inode->open_cnt);
+  lock_release (&inode->lock);
 }
 
 /* Re-enables writes to INODE.
@@ -332,9 +712,11 @@ inode_deny_write (struct inode *inode)
 void
 inode_allow_write (struct inode *inode) 
 {
+  lock_acquire (&inode->lock);
   ASSERT (inode->deny_write_cnt > 0);
   ASSERT (inode->deny_write_cnt <= inode->open_cnt);
   inode->deny_write_cnt--;
+  lock_release (&inode->lock);
 }
 
 /* Returns the length, in bytes, of INODE's data. */
@@ -343,3 +725,59 @@ inode_length (const struct inode *inode)
 {
   return inode->data.length;
 }
+
+/* Writes INODE, and all of its data and index blocks that are in
+   the buffer cache, to disk. */
+void
+inode_flush (struct inode *inode)
+{
+  struct inode_disk *disk = &inode->data;
+  size_t i;
+
+  lock_acquire (&inode->lock);
+  for (i = 0; i < inode->sector_cnt; i++)
+    cache_flush_sector (byte_to_sector (inode, i * BLOCK_SECTOR_SIZE));
+  if (disk->indirect != 0)
+    cache_flush_sector (disk->indirect);
+  if (disk->doubly_indirect != 0)
+    {
+      for (i = 0; i < PTRS_PER_SECTOR; i++)
+        {
+          block_sector_t leaf;
+          cache_read_at (disk->doubly_indirect, &leaf, i * sizeof leaf,
+                         sizeof leaf);
+          if (leaf != 0)
+            cache_flush_sector (leaf);
+        }
+      cache_flush_sector (disk->doubly_indirect);
+    }
+  cache_flush_sector (inode->sector);
+  lock_release (&inode->lock);
+}
+
+/* Acquires INODE's directory lock in exclusive mode, for a
+   change to the entries of the directory stored in INODE. */
+void
+inode_lock_dir (struct inode *inode)
+{
+  rwlock_acquire_exclusive (&inode->dir_lock);
+}
+
+/* Acquires INODE's directory lock in shared mode, for a lookup
+   or readdir that only reads the directory's entries. */
+void
+inode_lock_dir_shared (struct inode *inode)
+{
+  rwlock_acquire_shared (&inode->dir_lock);
+}
+
+/* Releases INODE's directory lock, in whichever mode the current
+   thread holds it. */
+void
+inode_unlock_dir (struct inode *inode)
+{
+  if (rwlock_held_exclusive_by_current_thread (&inode->dir_lock))
+    rwlock_release_exclusive (&inode->dir_lock);
+  else
+    rwlock_release_shared (&inode->dir_lock);
+}
@@ -0,0 +1,34 @@
+#ifndef __LIB_BLOCK_STATS_H
+#define __LIB_BLOCK_STATS_H
+
+#include <stdint.h>
+
+/* Number of buckets in a latency histogram.  Bucket I counts the
+   requests that took from 2**I up to 2**(I+1) CPU cycles, except
+   that bucket 0 also counts shorter ones and the last bucket
+   counts all longer ones. */
+#define BLOCK_LATENCY_BUCKETS 32
+
+/* Statistics for reads or writes on a block device.  A request's
+   service time runs from its submission, so it includes the time
+   that the request waited in the device's queue. */
+struct block_io_stats
+  {
+    uint64_t requests;          /* Completed requests. */
+    uint64_t bytes;             /* Bytes transferred. */
+    uint64_t total_cycles;      /* Sum of service times. */
+    uint64_t max_cycles;        /* Longest service time. */
+    uint32_t histogram[BLOCK_LATENCY_BUCKETS];  /* Service times. */
+  };
+
+/* Statistics for a block device, as returned by the block_stats
+   system call. */
+struct block_stats
+  {
+    char name[16];              /* Device name, e.g. "hda1". */
+    char role[16];              /* Role, e.g. "filesys", or "raw". */
+    struct block_io_stats reads;
+    struct block_io_stats writes;
+  };
+
+#endif /* lib/block-stats.h */
@@ -182,3 +182,15 @@ inumber (int fd)
 {
   return syscall1 (SYS_INUMBER, fd);
 }
+
+bool
+fsync (int fd)
+{
+  return syscall1 (SYS_FSYNC, fd);
+}
+
+bool
+block_stats (const char *device, struct block_stats *stats)
+{
+  return syscall2 (SYS_BLOCK_STATS, device, stats);
+}
@@ -3,6 +3,7 @@
 
 #include <stdbool.h>
 #include <debug.h>
+#include <block-stats.h>
 
 /* Process identifier. */
 typedef int pid_t;
@@ -45,4 +46,8 @@ bool readdir (int fd, char name[READDIR_MAX_LEN + 1]);
 bool isdir (int fd);
 int inumber (int fd);
 
+/* Extensions. */
+bool fsync (int fd);
+bool block_stats (const char *device, struct block_stats *);
+
 #endif /* lib/user/syscall.h */
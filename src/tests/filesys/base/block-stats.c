@@ -0,0 +1,48 @@
+/* Writes a file and flushes it to disk, then checks that the
+   statistics for the file system device, looked up by its role,
+   account for the writes consistently.  Also checks that an
+   unknown device name is rejected. */
+
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+static char buf[4096];
+
+void
+test_main (void) 
+{
+  const char *file_name = "data";
+  struct block_stats stats;
+  uint64_t histogram_cnt = 0;
+  int fd;
+  int i;
+
+  CHECK (create (file_name, sizeof buf), "create \"%s\"", file_name);
+  CHECK ((fd = open (file_name)) > 1, "open \"%s\"", file_name);
+  CHECK (write (fd, buf, sizeof buf) == sizeof buf,
+         "write \"%s\"", file_name);
+  CHECK (fsync (fd), "fsync \"%s\"", file_name);
+  msg ("close \"%s\"", file_name);
+  close (fd);
+
+  CHECK (block_stats ("filesys", &stats), "block_stats \"filesys\"");
+  if (strcmp (stats.role, "filesys"))
+    fail ("device has role \"%s\", not \"filesys\"", stats.role);
+  if (stats.writes.requests == 0)
+    fail ("no write requests counted");
+  if (stats.writes.bytes < sizeof buf)
+    fail ("only %llu bytes written", stats.writes.bytes);
+  if (stats.writes.max_cycles > stats.writes.total_cycles)
+    fail ("longest write exceeds total write time");
+  for (i = 0; i < BLOCK_LATENCY_BUCKETS; i++)
+    histogram_cnt += stats.writes.histogram[i];
+  if (histogram_cnt != stats.writes.requests)
+    fail ("histogram counts %llu writes, not %llu",
+          histogram_cnt, stats.writes.requests);
+  msg ("write statistics are consistent");
+
+  CHECK (!block_stats ("nonexistent", &stats),
+         "block_stats \"nonexistent\" (must return false)");
+}
@@ -0,0 +1,17 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(block-stats) begin
+(block-stats) create "data"
+(block-stats) open "data"
+(block-stats) write "data"
+(block-stats) fsync "data"
+(block-stats) close "data"
+(block-stats) block_stats "filesys"
+(block-stats) write statistics are consistent
+(block-stats) block_stats "nonexistent" (must return false)
+(block-stats) end
+EOF
+pass;
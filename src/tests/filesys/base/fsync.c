@@ -0,0 +1,39 @@
+/* Writes a file, flushes it to disk with fsync, and verifies
+   that its contents reached the disk, according to the file
+   system device's statistics, and read back intact.  Also checks
+   that fsync fails for a file descriptor that is not open. */
+
+#include <random.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+static char buf[1234];
+
+void
+test_main (void) 
+{
+  const char *file_name = "data";
+  struct block_stats before, after;
+  int fd;
+
+  random_init (0);
+  random_bytes (buf, sizeof buf);
+
+  CHECK (create (file_name, sizeof buf), "create \"%s\"", file_name);
+  CHECK ((fd = open (file_name)) > 1, "open \"%s\"", file_name);
+  CHECK (block_stats ("filesys", &before), "block_stats \"filesys\"");
+  CHECK (write (fd, buf, sizeof buf) == sizeof buf,
+         "write \"%s\"", file_name);
+  CHECK (fsync (fd), "fsync \"%s\"", file_name);
+  CHECK (block_stats ("filesys", &after), "block_stats \"filesys\"");
+  if (after.writes.bytes - before.writes.bytes < sizeof buf)
+    fail ("only %llu bytes reached the disk",
+          after.writes.bytes - before.writes.bytes);
+  msg ("contents of \"%s\" reached the disk", file_name);
+  msg ("close \"%s\"", file_name);
+  close (fd);
+
+  check_file (file_name, buf, sizeof buf);
+  CHECK (!fsync (fd), "fsync closed file descriptor (must return false)");
+}
@@ -0,0 +1,21 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(fsync) begin
+(fsync) create "data"
+(fsync) open "data"
+(fsync) block_stats "filesys"
+(fsync) write "data"
+(fsync) fsync "data"
+(fsync) block_stats "filesys"
+(fsync) contents of "data" reached the disk
+(fsync) close "data"
+(fsync) open "data" for verification
+(fsync) verified contents of "data"
+(fsync) close "data"
+(fsync) fsync closed file descriptor (must return false)
+(fsync) end
+EOF
+pass;
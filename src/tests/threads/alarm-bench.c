@@ -0,0 +1,121 @@
+/* Measures how much CPU time the timer interrupt takes away
+   from a running thread while 1, 100, and 1000 other threads are
+   blocked in timer_sleep().
+
+   The main thread spins for a fixed number of ticks, counting
+   loop iterations, first with no sleeping threads and then with
+   each number of sleepers.  Any time spent in the timer
+   interrupt handler shows up as fewer iterations per tick.
+
+   The test needs more than the default 4 MB of RAM for the 1000
+   sleeper threads' pages; see Make.tests. */
+
+#include <stdio.h>
+#include "tests/threads/tests.h"
+#include "threads/init.h"
+#include "threads/interrupt.h"
+#include "threads/malloc.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "devices/timer.h"
+
+/* Number of ticks to spin for in each measurement. */
+#define BENCH_TICKS 100
+
+/* Information shared with the sleeper threads. */
+struct bench_test
+  {
+    int64_t wake_time;          /* Tick at which the sleepers wake. */
+    int early_cnt;              /* Sleepers that woke before wake_time. */
+    struct semaphore done;      /* Up'd by each sleeper as it exits. */
+  };
+
+static void sleeper (void *);
+static unsigned spin_loops_per_tick (void);
+
+void
+test_alarm_bench (void)
+{
+  static const int sleeper_cnts[] = {1, 100, 1000};
+  struct bench_test test;
+  unsigned base;
+  size_t i;
+
+  /* This test does not work with the MLFQS. */
+  ASSERT (!thread_mlfqs);
+
+  sema_init (&test.done, 0);
+  test.early_cnt = 0;
+
+  base = spin_loops_per_tick ();
+  msg ("0 sleepers: %u loops/tick", base);
+
+  for (i = 0; i < sizeof sleeper_cnts / sizeof *sleeper_cnts; i++)
+    {
+      int cnt = sleeper_cnts[i];
+      unsigned loops;
+      int j;
+
+      /* The sleepers have a higher priority than us, so each one
+         runs, and goes to sleep, before thread_create() returns.
+         Leave them asleep well past the end of the measurement. */
+      test.wake_time = timer_ticks () + BENCH_TICKS + 3 * TIMER_FREQ;
+      for (j = 0; j < cnt; j++)
+        {
+          char name[24];
+          snprintf (name, sizeof name, "sleeper %d", j);
+          if (thread_create (name, PRI_DEFAULT + 1, sleeper, &test)
+              == TID_ERROR)
+            fail ("creating sleeper %d of %d failed", j, cnt);
+        }
+
+      loops = spin_loops_per_tick ();
+      msg ("%d sleepers: %u loops/tick (%u%% of 0 sleepers)",
+           cnt, loops, base != 0 ? (unsigned) (loops * 100ULL / base) : 0);
+
+      /* Wait for all the sleepers to wake up and exit. */
+      for (j = 0; j < cnt; j++)
+        sema_down (&test.done);
+    }
+
+  if (test.early_cnt != 0)
+    fail ("%d sleepers woke up early", test.early_cnt);
+  pass ();
+}
+
+/* Sleeper thread. */
+static void
+sleeper (void *test_)
+{
+  struct bench_test *test = test_;
+  enum intr_level old_level;
+
+  timer_sleep (test->wake_time - timer_ticks ());
+  if (timer_ticks () < test->wake_time)
+    {
+      old_level = intr_disable ();
+      test->early_cnt++;
+      intr_set_level (old_level);
+    }
+  sema_up (&test->done);
+}
+
+/* Spins for BENCH_TICKS timer ticks, starting at a tick
+   boundary, and returns the average number of loop iterations
+   completed per tick. */
+static unsigned
+spin_loops_per_tick (void)
+{
+  unsigned long long loops = 0;
+  int64_t start;
+
+  start = timer_ticks ();
+  while (timer_ticks () == start)
+    continue;
+
+  start = timer_ticks ();
+  while (timer_elapsed (start) < BENCH_TICKS)
+    loops++;
+
+  return loops / BENCH_TICKS;
+}
@@ -0,0 +1,20 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+
+our ($test);
+my (@output) = read_text_file ("$test.output");
+
+common_checks ("run", @output);
+
+@output = get_core_output ("run", @output);
+foreach my $cnt (0, 1, 100, 1000) {
+    fail "missing measurement for $cnt sleepers"
+      unless grep (/^\(alarm-bench\) $cnt sleepers: \d+ loops\/tick/,
+		   @output);
+}
+fail "missing PASS in output"
+  unless grep ($_ eq '(alarm-bench) PASS', @output);
+
+pass;
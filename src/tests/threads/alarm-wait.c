@@ -74,7 +74,7 @@ test_sleep (int thread_cnt, int iterations)
   /* Initialize test. */
   test.start = timer_ticks () + 100;
   test.iterations = iterations;
-  lock_init (&test.output_lock);
+  lock_init (&test.output_lock, NULL);
   test.output_pos = output;
 
   /* Start threads. */
@@ -0,0 +1,130 @@
+/* Compares the throughput of blocking and adaptive locks under
+   contention.
+
+   Several threads of equal priority repeatedly acquire a shared
+   lock, run a short critical section, and release the lock, for
+   a fixed number of ticks.  A timer interrupt that lands inside
+   the critical section preempts the holder, so the other threads
+   find the lock held by a ready thread.  A blocking lock puts
+   them to sleep on its semaphore; an adaptive lock has them
+   yield back to the holder instead.  The test reports the total
+   number of acquisitions per tick for each kind of lock.
+
+   Each critical section also does a non-atomic update of a
+   shared counter, which comes out wrong if the lock ever admits
+   two threads at once. */
+
+#include <stdio.h>
+#include "tests/threads/tests.h"
+#include "threads/init.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "devices/timer.h"
+
+/* Number of contending threads. */
+#define THREAD_CNT 4
+
+/* Number of ticks to run each measurement for. */
+#define BENCH_TICKS 100
+
+/* Number of loop iterations in each critical section. */
+#define CS_LOOPS 200
+
+/* Information shared with the contending threads. */
+struct lock_bench
+  {
+    struct lock lock;           /* The lock being measured. */
+    int64_t start, end;         /* Ticks at which to start, stop. */
+    unsigned counter;           /* Updated inside the lock. */
+    int next_id;                /* Next contender's index. */
+    unsigned acquires[THREAD_CNT]; /* Acquisitions by each thread. */
+    struct semaphore done;      /* Up'd by each thread as it exits. */
+  };
+
+static void contender (void *);
+static unsigned measure (const char *kind, bool adaptive);
+
+void
+test_lock_bench (void)
+{
+  unsigned blocking, adaptive;
+
+  blocking = measure ("blocking", false);
+  adaptive = measure ("adaptive", true);
+  msg ("adaptive/blocking: %u%%",
+       blocking != 0 ? (unsigned) (adaptive * 100ULL / blocking) : 0);
+  pass ();
+}
+
+/* Runs THREAD_CNT contending threads on a blocking or ADAPTIVE
+   lock, prints the resulting throughput labeled with KIND, and
+   returns the number of acquisitions per tick. */
+static unsigned
+measure (const char *kind, bool adaptive)
+{
+  static struct lock_bench bench;
+  unsigned long long total = 0;
+  unsigned per_tick;
+  int i;
+
+  if (adaptive)
+    lock_init_adaptive (&bench.lock, "lock-bench");
+  else
+    lock_init (&bench.lock, "lock-bench");
+  sema_init (&bench.done, 0);
+  bench.counter = 0;
+  bench.start = timer_ticks () + 2;
+  bench.end = bench.start + BENCH_TICKS;
+  bench.next_id = 0;
+
+  for (i = 0; i < THREAD_CNT; i++)
+    {
+      char name[16];
+      bench.acquires[i] = 0;
+      snprintf (name, sizeof name, "contender %d", i);
+      if (thread_create (name, PRI_DEFAULT, contender, &bench) == TID_ERROR)
+        fail ("creating contender %d failed", i);
+    }
+  for (i = 0; i < THREAD_CNT; i++)
+    sema_down (&bench.done);
+
+  for (i = 0; i < THREAD_CNT; i++)
+    total += bench.acquires[i];
+  if (bench.counter != total)
+    fail ("%s lock: counter is %u after %llu acquisitions",
+          kind, bench.counter, total);
+
+  per_tick = total / BENCH_TICKS;
+  msg ("%s lock: %u acquires/tick", kind, per_tick);
+  return per_tick;
+}
+
+/* Contending thread. */
+static void
+contender (void *bench_)
+{
+  struct lock_bench *bench = bench_;
+  int id;
+
+  lock_acquire (&bench->lock);
+  id = bench->next_id++;
+  lock_release (&bench->lock);
+
+  while (timer_ticks () < bench->start)
+    continue;
+
+  while (timer_ticks () < bench->end)
+    {
+      volatile unsigned counter;
+      int i;
+
+      lock_acquire (&bench->lock);
+      counter = bench->counter;
+      for (i = 0; i < CS_LOOPS; i++)
+        barrier ();
+      bench->counter = counter + 1;
+      bench->acquires[id]++;
+      lock_release (&bench->lock);
+    }
+  sema_up (&bench->done);
+}
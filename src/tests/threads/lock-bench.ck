@@ -0,0 +1,20 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+
+our ($test);
+my (@output) = read_text_file ("$test.output");
+
+common_checks ("run", @output);
+
+@output = get_core_output ("run", @output);
+foreach my $kind ('blocking', 'adaptive') {
+    fail "missing measurement for $kind lock"
+      unless grep (/^\(lock-bench\) $kind lock: \d+ acquires\/tick$/,
+		   @output);
+}
+fail "missing PASS in output"
+  unless grep ($_ eq '(lock-bench) PASS', @output);
+
+pass;
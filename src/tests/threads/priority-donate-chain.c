@@ -54,7 +54,7 @@ test_priority_donate_chain (void)
   thread_set_priority (PRI_MIN);
 
   for (i = 0; i < NESTING_DEPTH - 1; i++)
-    lock_init (&locks[i]);
+    lock_init (&locks[i], NULL);
 
   lock_acquire (&locks[0]);
   msg ("%s got lock.", thread_name ());
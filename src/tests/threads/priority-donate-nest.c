@@ -36,8 +36,8 @@ test_priority_donate_nest (void)
   /* Make sure our priority is the default. */
   ASSERT (thread_get_priority () == PRI_DEFAULT);
 
-  lock_init (&a);
-  lock_init (&b);
+  lock_init (&a, NULL);
+  lock_init (&b, NULL);
 
   lock_acquire (&a);
 
@@ -0,0 +1,62 @@
+/* The main thread acquires a readers-writer lock in shared mode.
+   Then it creates a higher-priority writer, which blocks waiting
+   for the main thread to leave, and a still higher-priority
+   reader, which is held back for the writer.  Both donate their
+   priority to the main thread, although it holds the lock only
+   as a reader.  When the main thread releases the lock, the
+   writer and then the reader should get it, and the main thread
+   should drop back to its own priority. */
+
+#include <stdio.h>
+#include "tests/threads/tests.h"
+#include "threads/init.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+
+static thread_func writer_thread_func;
+static thread_func reader_thread_func;
+
+void
+test_priority_donate_rwlock (void) 
+{
+  struct rwlock rw;
+
+  /* This test does not work with the MLFQS. */
+  ASSERT (!thread_mlfqs);
+
+  /* Make sure our priority is the default. */
+  ASSERT (thread_get_priority () == PRI_DEFAULT);
+
+  rwlock_init (&rw, NULL, true);
+  rwlock_acquire_shared (&rw);
+  thread_create ("writer", PRI_DEFAULT + 2, writer_thread_func, &rw);
+  msg ("This thread should have priority %d.  Actual priority: %d.",
+       PRI_DEFAULT + 2, thread_get_priority ());
+  thread_create ("reader", PRI_DEFAULT + 3, reader_thread_func, &rw);
+  msg ("This thread should have priority %d.  Actual priority: %d.",
+       PRI_DEFAULT + 3, thread_get_priority ());
+  rwlock_release_shared (&rw);
+  msg ("writer, reader must already have finished, in that order.");
+  msg ("This thread should have priority %d.  Actual priority: %d.",
+       PRI_DEFAULT, thread_get_priority ());
+}
+
+static void
+writer_thread_func (void *rw_) 
+{
+  struct rwlock *rw = rw_;
+
+  rwlock_acquire_exclusive (rw);
+  msg ("writer: got the lock");
+  rwlock_release_exclusive (rw);
+}
+
+static void
+reader_thread_func (void *rw_) 
+{
+  struct rwlock *rw = rw_;
+
+  rwlock_acquire_shared (rw);
+  msg ("reader: got the lock");
+  rwlock_release_shared (rw);
+}
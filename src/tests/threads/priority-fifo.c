@@ -48,7 +48,7 @@ test_priority_fifo (void)
 
   output = op = malloc (sizeof *output * THREAD_CNT * ITER_CNT * 2);
   ASSERT (output != NULL);
-  lock_init (&lock);
+  lock_init (&lock, NULL);
 
   thread_set_priority (PRI_DEFAULT + 2);
   for (i = 0; i < THREAD_CNT; i++) 
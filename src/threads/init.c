@@ -34,6 +34,7 @@
 #ifdef FILESYS
 #include "devices/block.h"
 #include "devices/ide.h"
+#include "filesys/cache.h"
 #include "filesys/filesys.h"
 #include "filesys/fsutil.h"
 #endif
@@ -129,6 +130,7 @@ main (void)
 #ifdef FILESYS
   /* Initialize file system. */
   ide_init ();
+  block_check_schedulers ();
   locate_block_devices ();
   filesys_init (format_filesys);
 
@@ -257,6 +259,10 @@ parse_options (char **argv)
         filesys_bdev_name = value;
       else if (!strcmp (name, "-scratch"))
         scratch_bdev_name = value;
+      else if (!strcmp (name, "-cache"))
+        cache_size = atoi (value);
+      else if (!strcmp (name, "-iosched"))
+        block_configure_scheduler (value);
 #ifdef VM
       else if (!strcmp (name, "-swap"))
         swap_bdev_name = value;
@@ -266,6 +272,12 @@ parse_options (char **argv)
         random_init (atoi (value));
       else if (!strcmp (name, "-mlfqs"))
         thread_mlfqs = true;
+      else if (!strcmp (name, "-tickless"))
+        timer_tickless = true;
+#ifdef LOCK_PROFILE
+      else if (!strcmp (name, "-lockprof"))
+        lock_profile_top = value != NULL ? atoi (value) : 10;
+#endif
       else if (!strcmp (name, "-debug"))
           debug = true;
 #ifdef USERPROG
@@ -385,12 +397,20 @@ usage (void)
           "  -f                 Format file system device during startup.\n"
           "  -filesys=BDEV      Use BDEV for file system instead of default.\n"
           "  -scratch=BDEV      Use BDEV for scratch instead of default.\n"
+          "  -cache=N           Cache N file system sectors (default 64).\n"
+          "  -iosched=[DISK:]SCHED  Schedule DISK's (or all disks') I/O with\n"
+          "                     SCHED: noop, clook, or deadline (default).\n"
+          "                     DISK is a whole disk, e.g. hda, not hda1.\n"
 #ifdef VM
           "  -swap=BDEV         Use BDEV for swap instead of default.\n"
 #endif
 #endif
           "  -rs=SEED           Set random number seed to SEED.\n"
           "  -mlfqs             Use multi-level feedback queue scheduler.\n"
+          "  -tickless          Stop the timer tick while the CPU is idle.\n"
+#ifdef LOCK_PROFILE
+          "  -lockprof[=N]      Print the N most contended locks at shutdown.\n"
+#endif
 #ifdef USERPROG
           "  -ul=COUNT          Limit user memory to COUNT pages.\n"
 #endif
@@ -359,6 +359,10 @@ intr_handler (struct intr_frame *frame)
 
       in_external_intr = true;
       yield_on_return = false;
+
+      /* Catch up on ticks skipped by a tickless idle CPU before
+         any handler looks at the time. */
+      timer_idle_exit ();
     }
 
   /* Invoke the interrupt's handler. */
@@ -31,6 +31,23 @@
 #include <string.h>
 #include "threads/interrupt.h"
 #include "threads/thread.h"
+#include "devices/timer.h"
+
+/* Number of entries in the lock profile to show at shutdown, or
+   0 to show none.  Set by kernel command-line option
+   "-lockprof=N" when the kernel is built with LOCK_PROFILE. */
+int lock_profile_top;
+
+#ifdef LOCK_PROFILE
+/* Statistics for each distinct lock name.  Locks with the same
+   name, such as those of the malloc descriptors, share an entry.
+   Once the table fills up, new names share the last entry. */
+#define LOCK_PROFILE_CNT 64
+static struct lock_profile lock_profiles[LOCK_PROFILE_CNT];
+static size_t lock_profile_cnt;
+
+static struct lock_profile *lock_profile_lookup (const char *name);
+#endif
 
 /* Initializes semaphore SEMA to VALUE.  A semaphore is a
    nonnegative integer along with two atomic operators for
@@ -129,6 +146,9 @@ sema_up (struct semaphore *sema)
 }
 
 static void sema_test_helper (void *sema_);
+static void lock_donate (struct lock *);
+static void donate_chain (struct thread *, int priority);
+static void lock_take (struct lock *);
 
 /* Self-test for semaphores that makes control "ping-pong"
    between a pair of threads.  Insert calls to printf() to see
@@ -165,10 +185,14 @@ sema_test_helper (void *sema_)
     }
 }
 
-/* Initializes LOCK.  A lock can be held by at most a single
-   thread at any given time.  Our locks are not "recursive", that
-   is, it is an error for the thread currently holding a lock to
-   try to acquire that lock.
+/* Initializes LOCK, which is called NAME in the lock profile.
+   NAME may be a null pointer for locks not worth reporting
+   separately.
+
+   A lock can be held by at most a single thread at any given
+   time.  Our locks are not "recursive", that is, it is an error
+   for the thread currently holding a lock to try to acquire
+   that lock.
 
    A lock is a specialization of a semaphore with an initial
    value of 1.  The difference between a lock and such a
@@ -181,15 +205,33 @@ sema_test_helper (void *sema_)
    onerous, it's a good sign that a semaphore should be used,
    instead of a lock. */
 void
-lock_init (struct lock *lock)
+lock_init (struct lock *lock, const char *name UNUSED)
 {
   ASSERT (lock != NULL);
 
   lock->holder = NULL;
-  lock->priority = 0;
+  lock->priority = PRI_MIN;
+  lock->adaptive = false;
+#ifdef LOCK_PROFILE
+  lock->profile = lock_profile_lookup (name);
+  lock->acquire_time = 0;
+#endif
   sema_init (&lock->semaphore, 1);
 }
 
+/* Initializes LOCK, called NAME, as an adaptive lock, for
+   critical sections short enough that they rarely span a context
+   switch.  A thread that finds such a lock held by a thread that
+   is ready, but not running, yields to the holder up to
+   LOCK_SPIN_CNT times, rechecking the lock each time, before it
+   blocks as lock_acquire() normally does. */
+void
+lock_init_adaptive (struct lock *lock, const char *name)
+{
+  lock_init (lock, name);
+  lock->adaptive = true;
+}
+
 /* Acquires LOCK, sleeping until it becomes available if
    necessary.  The lock must not already be held by the current
    thread.
@@ -205,34 +247,130 @@ lock_acquire (struct lock *lock)
   ASSERT (!intr_context ());
   ASSERT (!lock_held_by_current_thread (lock));
 
-  enum intr_level old_level = intr_disable();
-  if(lock->holder != NULL)
+#ifdef LOCK_PROFILE
+  int64_t wait_start = timer_ticks ();
+  bool contended = lock->semaphore.value == 0;
+#endif
+  bool acquired = false;
+  int spins = 0;
+  for(;;)
   {
-    thread_current()->waiting_on_lock = lock;
+    enum intr_level old_level = intr_disable();
+    struct thread * holder = lock->holder;
+    bool spin;
 
-    struct lock * l = lock;
-    int i = 8;
-    while(l != NULL && (i--) > 0)
+    if(holder != NULL && !thread_mlfqs)
     {
-      if(l->holder == NULL) break;
+      thread_current()->waiting_on_lock = lock;
+      lock_donate(lock);
+    }
 
-      int old_priority = l->priority;
-      int other_priority = thread_get_other_priority(l->holder);
-      int this_priority = thread_get_priority();
+    /* An adaptive lock whose holder was merely preempted, and
+       will run as soon as we step aside, is likely to be released
+       within a time slice.  Yielding to the holder avoids queuing
+       on the semaphore and the wakeup that goes with it. */
+    spin = lock->adaptive && holder != NULL
+           && holder->status == THREAD_READY
+           && thread_get_other_priority(holder) >= thread_get_priority()
+           && spins++ < LOCK_SPIN_CNT;
+    intr_set_level(old_level);
+    if(!spin)
+      break;
+
+    thread_yield();
+    if(sema_try_down(&lock->semaphore))
+    {
+      acquired = true;
+      break;
+    }
+  }
+  if(!acquired)
+    sema_down (&lock->semaphore);
 
-      if(other_priority > this_priority)
-        break;
+#ifdef LOCK_PROFILE
+  if(contended)
+  {
+    enum intr_level old_level = intr_disable();
+    lock->profile->contended++;
+    lock->profile->wait_ticks += timer_elapsed (wait_start);
+    intr_set_level(old_level);
+  }
+#endif
+  lock_take (lock);
+}
 
-      thread_donate(l->holder, this_priority, old_priority);
+/* Donates the current thread's priority along the chain of
+   lock holders that starts at LOCK's.  Each lock remembers the
+   highest priority among its waiters, so the walk stops as soon
+   as a lock already carries it.  Interrupts must be off. */
+static void
+lock_donate (struct lock *lock)
+{
+  int p = thread_get_priority();
+
+  ASSERT (intr_get_level () == INTR_OFF);
 
-      l->priority = this_priority;
+  if(lock->holder != NULL && lock->priority < p)
+  {
+    lock->priority = p;
+    donate_chain(lock->holder, p);
+  }
+}
+
+/* Donates priority P to HOLDER and, if HOLDER is itself waiting
+   for a lock, onward to that lock's holder, and so on.
+   Interrupts must be off. */
+static void
+donate_chain (struct thread *holder, int p)
+{
+  for(;;)
+  {
+    struct lock * l;
 
-      l = l->holder->waiting_on_lock;
+    thread_donate(holder, p);
+
+    /* A holder that is itself waiting for a lock must move up in
+       that lock's waiter list, which is ordered by priority. */
+    l = holder->waiting_on_lock;
+    if(l == NULL)
+      break;
+    if(holder->status == THREAD_BLOCKED)
+    {
+      list_remove(&holder->elem);
+      list_insert_ordered(&l->semaphore.waiters, &holder->elem,
+        smaller_priority, NULL);
     }
+    p = thread_get_other_priority(holder);
+    if(l->holder == NULL || l->priority >= p)
+      break;
+    l->priority = p;
+    holder = l->holder;
   }
+}
+
+/* Records the current thread, which has just downed LOCK's
+   semaphore, as LOCK's holder.  LOCK's priority becomes that of
+   its highest-priority remaining waiter, which is donated to
+   the new holder. */
+static void
+lock_take (struct lock *lock)
+{
+  struct thread * cur = thread_current();
+  enum intr_level old_level = intr_disable();
+
+  cur->waiting_on_lock = NULL;
+  lock->holder = cur;
+  lock->priority = PRI_MIN;
+  if(!thread_mlfqs && !list_empty(&lock->semaphore.waiters))
+    lock->priority = thread_get_other_priority(
+      list_entry(list_back(&lock->semaphore.waiters), struct thread, elem));
+  list_push_back(&cur->held_locks, &lock->elem);
+  thread_donate(cur, lock->priority);
+#ifdef LOCK_PROFILE
+  lock->profile->acquires++;
+  lock->acquire_time = timer_ticks ();
+#endif
   intr_set_level(old_level);
-  sema_down (&lock->semaphore);
-  lock->holder = thread_current ();
 }
 
 /* Tries to acquires LOCK and returns true if successful or false
@@ -251,7 +389,7 @@ lock_try_acquire (struct lock *lock)
 
   success = sema_try_down (&lock->semaphore);
   if (success)
-    lock->holder = thread_current ();
+    lock_take (lock);
 
   return success;
 }
@@ -267,25 +405,20 @@ lock_release (struct lock *lock)
   ASSERT (lock != NULL);
   ASSERT (lock_held_by_current_thread (lock));
 
-  /* Remove donation from itself */
-  thread_revoke_donation(lock->holder, lock->priority);
-
-  int max = 0;
-
-  if(!list_empty(&lock->semaphore.waiters))
-  {
-    struct list_elem * e;
-    for (e = list_begin (&lock->semaphore.waiters);
-      e != list_end (&lock->semaphore.waiters);
-      e = list_next (e))
-    {
-      struct thread * t = list_entry(e, struct thread, elem);
-      // thread_revoke_donation(t, lock->priority);
-      max = MAX(t->priority, max);
-    }
-  }
-  lock->priority = max;
+  /* Give back what was donated through LOCK.  The next holder
+     picks up the waiters' priority again in lock_take(). */
+  enum intr_level old_level = intr_disable();
+#ifdef LOCK_PROFILE
+  int64_t held = timer_elapsed (lock->acquire_time);
+  if(held > lock->profile->max_hold_ticks)
+    lock->profile->max_hold_ticks = held;
+#endif
+  list_remove(&lock->elem);
   lock->holder = NULL;
+  lock->priority = PRI_MIN;
+  thread_revoke_donation(thread_current());
+  intr_set_level(old_level);
+
   sema_up (&lock->semaphore);
 }
 
@@ -299,6 +432,78 @@ lock_held_by_current_thread (const struct lock *lock)
 
   return lock->holder == thread_current ();
 }
+
+#ifdef LOCK_PROFILE
+/* Returns the profile entry for locks called NAME, creating it
+   if necessary.  NAME must remain valid forever. */
+static struct lock_profile *
+lock_profile_lookup (const char *name)
+{
+  enum intr_level old_level;
+  size_t i;
+
+  if (name == NULL)
+    name = "(unnamed)";
+
+  old_level = intr_disable ();
+  for (i = 0; i < lock_profile_cnt; i++)
+    if (!strcmp (lock_profiles[i].name, name))
+      break;
+  if (i == lock_profile_cnt)
+    {
+      if (lock_profile_cnt < LOCK_PROFILE_CNT)
+        lock_profiles[lock_profile_cnt++].name = name;
+      else
+        i = LOCK_PROFILE_CNT - 1;
+    }
+  intr_set_level (old_level);
+
+  return &lock_profiles[i];
+}
+#endif
+
+/* Prints the lock_profile_top most contended lock names, if the
+   kernel keeps a lock profile and the option was given. */
+void
+lock_print_stats (void)
+{
+#ifdef LOCK_PROFILE
+  bool printed[LOCK_PROFILE_CNT];
+  int n;
+
+  if (lock_profile_top <= 0)
+    return;
+
+  memset (printed, 0, sizeof printed);
+  printf ("Locks: %zu names, top %d by contention (times in ticks):\n",
+          lock_profile_cnt, lock_profile_top);
+  printf ("  %-16s %12s %12s %10s %8s\n",
+          "name", "acquires", "contended", "wait", "max hold");
+  for (n = 0; n < lock_profile_top; n++)
+    {
+      struct lock_profile *p, *max = NULL;
+      size_t i;
+
+      for (i = 0; i < lock_profile_cnt; i++)
+        {
+          p = &lock_profiles[i];
+          if (!printed[i]
+              && (max == NULL
+                  || p->contended > max->contended
+                  || (p->contended == max->contended
+                      && p->wait_ticks > max->wait_ticks)))
+            max = p;
+        }
+      if (max == NULL)
+        break;
+
+      printed[max - lock_profiles] = true;
+      printf ("  %-16s %12llu %12llu %10lld %8lld\n", max->name,
+              max->acquires, max->contended,
+              max->wait_ticks, max->max_hold_ticks);
+    }
+#endif
+}
 
 /* One semaphore in a list. */
 struct semaphore_elem 
@@ -403,3 +608,193 @@ cond_broadcast (struct condition *cond, struct lock *lock)
   while (!list_empty (&cond->waiters))
     cond_signal (cond, lock);
 }
+
+/* Initializes RWLOCK, called NAME in the lock profile.  A
+   readers-writer lock may be held by any number of threads in
+   shared mode or by a single thread in exclusive mode, but not
+   both at once.
+
+   A writer holds RWLOCK's inner lock for as long as it holds
+   RWLOCK, so threads that wait for a writer, in either mode,
+   donate their priority to it, and the highest-priority waiter
+   is the next to get in.  Each reader records its hold in one of
+   its thread's rwlock_holds, so that threads that wait for the
+   readers to leave can donate their priority to all of them in
+   turn.  A thread may hold at most RWLOCK_HOLD_CNT
+   readers-writer locks in shared mode at once.
+
+   If PREFER_WRITERS is true, then new readers wait while a
+   writer is waiting for the current readers to leave, so that a
+   steady stream of readers cannot starve writers.  Otherwise,
+   readers are admitted whenever no writer holds RWLOCK. */
+void
+rwlock_init (struct rwlock *rw, const char *name, bool prefer_writers)
+{
+  ASSERT (rw != NULL);
+
+  lock_init (&rw->lock, name);
+  cond_init (&rw->readers_ok);
+  cond_init (&rw->no_readers);
+  rw->readers = 0;
+  rw->writers_waiting = 0;
+  rw->prefer_writers = prefer_writers;
+  list_init (&rw->holds);
+  rw->priority = PRI_MIN;
+}
+
+/* Donates the current thread's priority to every thread that
+   holds RW in shared mode, before the current thread waits for
+   them to leave.  RW's inner lock must be held. */
+static void
+rwlock_donate (struct rwlock *rw)
+{
+  enum intr_level old_level;
+  struct list_elem *e;
+  int p;
+
+  if (thread_mlfqs)
+    return;
+
+  old_level = intr_disable ();
+  p = thread_get_priority ();
+  if (p > rw->priority)
+    {
+      rw->priority = p;
+      for (e = list_begin (&rw->holds); e != list_end (&rw->holds);
+           e = list_next (e))
+        donate_chain (list_entry (e, struct rwlock_hold, elem)->thread, p);
+    }
+  intr_set_level (old_level);
+}
+
+/* Acquires RW in shared mode, sleeping until no writer holds it
+   and, if RW prefers writers, none is waiting for it.  The new
+   reader inherits the priority of any writers still waiting for
+   readers to leave.
+
+   This function may sleep, so it must not be called within an
+   interrupt handler. */
+void
+rwlock_acquire_shared (struct rwlock *rw)
+{
+  struct thread *cur = thread_current ();
+  struct rwlock_hold *hold = NULL;
+  enum intr_level old_level;
+  int i;
+
+  ASSERT (rw != NULL);
+  ASSERT (!rwlock_held_exclusive_by_current_thread (rw));
+
+  for (i = 0; i < RWLOCK_HOLD_CNT; i++)
+    if (cur->rwlock_holds[i].rwlock == NULL)
+      {
+        hold = &cur->rwlock_holds[i];
+        break;
+      }
+  ASSERT (hold != NULL);
+
+  lock_acquire (&rw->lock);
+  while (rw->prefer_writers && rw->writers_waiting > 0)
+    {
+      rwlock_donate (rw);
+      cond_wait (&rw->readers_ok, &rw->lock);
+    }
+  rw->readers++;
+
+  old_level = intr_disable ();
+  hold->rwlock = rw;
+  hold->thread = cur;
+  list_push_back (&rw->holds, &hold->elem);
+  thread_donate (cur, rw->priority);
+  intr_set_level (old_level);
+
+  lock_release (&rw->lock);
+}
+
+/* Releases RW, which the current thread must hold in shared
+   mode, and gives back what was donated through it.  The last
+   reader out wakes the writers waiting for RW, which then take
+   it one at a time in priority order. */
+void
+rwlock_release_shared (struct rwlock *rw)
+{
+  struct thread *cur = thread_current ();
+  enum intr_level old_level;
+  int i;
+
+  ASSERT (rw != NULL);
+
+  lock_acquire (&rw->lock);
+  ASSERT (rw->readers > 0);
+
+  old_level = intr_disable ();
+  for (i = 0; i < RWLOCK_HOLD_CNT; i++)
+    if (cur->rwlock_holds[i].rwlock == rw)
+      break;
+  ASSERT (i < RWLOCK_HOLD_CNT);
+  list_remove (&cur->rwlock_holds[i].elem);
+  cur->rwlock_holds[i].rwlock = NULL;
+  thread_revoke_donation (cur);
+  intr_set_level (old_level);
+
+  if (--rw->readers == 0)
+    cond_broadcast (&rw->no_readers, &rw->lock);
+  lock_release (&rw->lock);
+}
+
+/* Acquires RW in exclusive mode, sleeping until no other thread
+   holds it in either mode.  While it waits for readers to leave,
+   the current thread donates its priority to them.
+
+   This function may sleep, so it must not be called within an
+   interrupt handler. */
+void
+rwlock_acquire_exclusive (struct rwlock *rw)
+{
+  enum intr_level old_level;
+
+  ASSERT (rw != NULL);
+
+  lock_acquire (&rw->lock);
+  rw->writers_waiting++;
+  while (rw->readers > 0)
+    {
+      rwlock_donate (rw);
+      cond_wait (&rw->no_readers, &rw->lock);
+    }
+  rw->writers_waiting--;
+
+  /* Readers held back for writers now wait for us, outside the
+     inner lock's waiter list, so take over their donation. */
+  old_level = intr_disable ();
+  if (rw->priority > rw->lock.priority)
+    {
+      rw->lock.priority = rw->priority;
+      thread_donate (thread_current (), rw->priority);
+    }
+  intr_set_level (old_level);
+}
+
+/* Releases RW, which the current thread must hold in exclusive
+   mode, and wakes any readers that held back for writers.  No
+   thread is left waiting for readers, so what they donated is
+   forgotten. */
+void
+rwlock_release_exclusive (struct rwlock *rw)
+{
+  ASSERT (rwlock_held_exclusive_by_current_thread (rw));
+
+  rw->priority = PRI_MIN;
+  cond_broadcast (&rw->readers_ok, &rw->lock);
+  lock_release (&rw->lock);
+}
+
+/* Returns true if the current thread holds RW in exclusive mode,
+   false otherwise. */
+bool
+rwlock_held_exclusive_by_current_thread (const struct rwlock *rw)
+{
+  ASSERT (rw != NULL);
+
+  return lock_held_by_current_thread (&rw->lock);
+}
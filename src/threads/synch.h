@@ -3,6 +3,7 @@
 
 #include <list.h>
 #include <stdbool.h>
+#include <stdint.h>
 
 /* A counting semaphore. */
 struct semaphore 
@@ -17,20 +18,48 @@ bool sema_try_down (struct semaphore *);
 void sema_up (struct semaphore *);
 void sema_self_test (void);
 
+#ifdef LOCK_PROFILE
+/* Contention statistics, shared by all the locks with a given
+   name.  Kept only when the kernel is built with LOCK_PROFILE
+   defined, e.g. "make LOCK_PROFILE=1". */
+struct lock_profile
+  {
+    const char *name;           /* Name given to lock_init(). */
+    unsigned long long acquires; /* Number of acquisitions. */
+    unsigned long long contended; /* Acquisitions that found it held. */
+    int64_t wait_ticks;         /* Total ticks spent waiting. */
+    int64_t max_hold_ticks;     /* Longest time held, in ticks. */
+  };
+#endif
+
 /* Lock. */
 struct lock 
   {
     struct thread *holder;      /* Thread holding lock (for debugging). */
     struct semaphore semaphore; /* Binary semaphore controlling access. */
-    int priority;               /* Highest donated priority for this lock */
+    int priority;               /* Highest priority of the waiters */
+    struct list_elem elem;      /* Element in holder's held_locks */
+    bool adaptive;              /* Yield to a ready holder before blocking? */
+#ifdef LOCK_PROFILE
+    struct lock_profile *profile; /* Statistics for this lock's name. */
+    int64_t acquire_time;       /* Tick at which holder acquired it. */
+#endif
   };
 
-void lock_init (struct lock *);
+/* Number of times an adaptive lock yields to its holder before
+   its waiter blocks. */
+#define LOCK_SPIN_CNT 4
+
+void lock_init (struct lock *, const char *name);
+void lock_init_adaptive (struct lock *, const char *name);
 void lock_acquire (struct lock *);
 bool lock_try_acquire (struct lock *);
 void lock_release (struct lock *);
 bool lock_held_by_current_thread (const struct lock *);
 
+extern int lock_profile_top;
+void lock_print_stats (void);
+
 /* Condition variable. */
 struct condition 
   {
@@ -42,6 +71,39 @@ void cond_wait (struct condition *, struct lock *);
 void cond_signal (struct condition *, struct lock *);
 void cond_broadcast (struct condition *, struct lock *);
 
+/* Readers-writer lock. */
+struct rwlock
+  {
+    struct lock lock;           /* Held throughout by the writer. */
+    struct condition readers_ok; /* Signaled when a writer leaves. */
+    struct condition no_readers; /* Signaled when the last reader leaves. */
+    unsigned readers;           /* Number of threads holding it shared. */
+    unsigned writers_waiting;   /* Writers waiting for readers to leave. */
+    bool prefer_writers;        /* Hold off new readers for writers? */
+    struct list holds;          /* Readers' struct rwlock_hold. */
+    int priority;               /* Highest priority waiting on readers. */
+  };
+
+/* A thread's shared hold on a readers-writer lock.  Each thread
+   has RWLOCK_HOLD_CNT of these, so that waiters can donate their
+   priority to the readers they wait for. */
+struct rwlock_hold
+  {
+    struct rwlock *rwlock;      /* Lock held shared, or null if free. */
+    struct thread *thread;      /* Thread that holds it. */
+    struct list_elem elem;      /* Element in RWLOCK's holds. */
+  };
+
+/* Most readers-writer locks a thread may hold shared at once. */
+#define RWLOCK_HOLD_CNT 4
+
+void rwlock_init (struct rwlock *, const char *name, bool prefer_writers);
+void rwlock_acquire_shared (struct rwlock *);
+void rwlock_release_shared (struct rwlock *);
+void rwlock_acquire_exclusive (struct rwlock *);
+void rwlock_release_exclusive (struct rwlock *);
+bool rwlock_held_exclusive_by_current_thread (const struct rwlock *);
+
 /* Optimization barrier.
 
    The compiler will not reorder operations across an
@@ -2,6 +2,7 @@
 #include <debug.h>
 #include <stddef.h>
 #include <random.h>
+#include <round.h>
 #include <stdio.h>
 #include <string.h>
 #include "threads/flags.h"
@@ -22,9 +23,15 @@
    of thread.h for details. */
 #define THREAD_MAGIC 0xcd6abf4b
 
-/* List of processes in THREAD_READY state, that is, processes
-   that are ready to run but not actually running. */
-static struct list ready_list;
+/* Run queue of processes in THREAD_READY state, that is,
+   processes that are ready to run but not actually running.
+   There is one FIFO list per priority level and a bitmap with a
+   bit set for every level whose list is non-empty, so that both
+   queueing a thread and picking the next one take O(1) time. */
+#define PRI_CNT (PRI_MAX - PRI_MIN + 1)
+static struct list ready_queues[PRI_CNT];
+static uint32_t ready_bitmap[DIV_ROUND_UP (PRI_CNT, 32)];
+static size_t ready_cnt;        /* # of threads in all ready_queues. */
 
 /* List of all processes.  Processes are added to this list
    when they are first scheduled and removed when they exit. */
@@ -66,7 +73,6 @@ bool debug;
 
 static void kernel_thread (thread_func *, void *aux);
 
-static void thread_check_ticks (struct thread *t, void *aux);
 static void idle (void *aux UNUSED);
 static struct thread *running_thread (void);
 static struct thread *next_thread_to_run (void);
@@ -76,6 +82,11 @@ static void *alloc_frame (struct thread *, size_t size);
 static void schedule (void);
 void thread_schedule_tail (struct thread *prev);
 static tid_t allocate_tid (void);
+static int ready_priority (struct thread *);
+static void ready_queue_push (struct thread *);
+static void ready_queue_remove (struct thread *);
+static struct thread *ready_queue_pop (void);
+static int ready_queue_highest (void);
 static fixed_point calculate_recent_cpu(fixed_point recent_cpu, int niceness);
 static void update_recent_cpu(struct thread * t, void * aux UNUSED);
 static void calculate_priority(struct thread * t, void * aux UNUSED);
@@ -96,10 +107,14 @@ static void calculate_priority(struct thread * t, void * aux UNUSED);
 void
 thread_init (void) 
 {
+  int i;
+
   ASSERT (intr_get_level () == INTR_OFF);
 
-  lock_init (&tid_lock);
-  list_init (&ready_list);
+  lock_init (&tid_lock, "tid");
+  for (i = 0; i < PRI_CNT; i++)
+    list_init (&ready_queues[i]);
+  ready_cnt = 0;
   list_init (&all_list);
 
   load_avg = 0;
@@ -128,22 +143,6 @@ thread_start (void)
   sema_down (&idle_started);
 }
 
-
-static void
-thread_check_ticks (struct thread *t, void *aux UNUSED)
-{
-  
-  if (t->status == THREAD_BLOCKED && t->ticks != 0)
-  {
-    if(t->ticks <= timer_ticks())
-    {
-      t->ticks = 0;
-      thread_unblock(t);
-    }  
-  }
-    
-}
-
 /* Called by the timer interrupt handler at each timer tick.
    Thus, this function runs in an external interrupt context. */
 void
@@ -163,8 +162,6 @@ thread_tick (void)
 
   thread_current()->recent_cpu++;
 
-  thread_foreach(thread_check_ticks, NULL);
-
   if(thread_mlfqs)
   {
     enum intr_level old_level = intr_disable ();
@@ -177,7 +174,8 @@ thread_tick (void)
     }
 
     // In addition, once per second the value of recent_cpu is recalculated for 
-    // every thread (whether running, ready, or blocked)
+    // every thread (whether running, ready, or blocked).  Each thread's
+    // priority is recalculated in the same pass.
     if(timer_ticks() % TIMER_FREQ == 0)
     {
       thread_foreach(update_recent_cpu, NULL);
@@ -190,7 +188,7 @@ thread_tick (void)
       fixed_point a = div(to_fixed_point(59), to_fixed_point(60));
       fixed_point b = div(to_fixed_point(1), to_fixed_point(60));
       if(thread_current() != idle_thread)
-        load_avg = add(multi(a, load_avg), multi_int(b, list_size(&ready_list) + 1));
+        load_avg = add(multi(a, load_avg), multi_int(b, ready_cnt + 1));
       else
         load_avg = multi(a, load_avg);
       if(debug)
@@ -198,13 +196,14 @@ thread_tick (void)
 
     }
 
-    // Calculate priority every four ticks
+    // Calculate priority every four ticks.  Between the once-per-second
+    // passes above, only the running thread's recent_cpu changes, so it is
+    // the only thread whose priority has to be recalculated.
     if(timer_ticks() % 4 == 0)
     {
-      thread_foreach(calculate_priority, NULL);
-      // calculate_priority(thread_current(), NULL);
-      
-      if(thread_current() != list_entry(list_end(&ready_list), struct thread, elem))
+      calculate_priority(thread_current(), NULL);
+
+      if(ready_queue_highest() >= thread_current()->priority)
       {
         intr_yield_on_return();
       }
@@ -219,6 +218,17 @@ thread_tick (void)
   }
 }
 
+/* Accounts for CNT timer ticks that went by without a timer
+   interrupt while the idle thread ran in tickless mode.  See
+   timer_idle_enter(). */
+void
+thread_idle_ticks (int64_t cnt)
+{
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  idle_ticks += cnt;
+}
+
 /* Prints thread statistics. */
 void
 thread_print_stats (void) 
@@ -291,7 +301,7 @@ thread_create (const char *name, int priority,
       // inherited from parent thread
       t->niceness = thread_get_nice();
       t->recent_cpu = div_int(to_fixed_point(thread_get_recent_cpu()), 100);
-      t->priority = calculate_recent_cpu(t->recent_cpu, t->niceness);
+      calculate_priority(t, NULL);
     }
   }
 
@@ -353,7 +363,7 @@ thread_unblock (struct thread *t)
 
   old_level = intr_disable ();
   ASSERT (t->status == THREAD_BLOCKED);
-  list_insert_ordered (&ready_list, &t->elem, smaller_priority, NULL);
+  ready_queue_push (t);
   t->status = THREAD_READY;
   intr_set_level (old_level);
 }
@@ -442,7 +452,7 @@ thread_yield (void)
 
   old_level = intr_disable ();
   if (cur != idle_thread) 
-    list_insert_ordered (&ready_list, &cur->elem, smaller_priority, NULL);
+    ready_queue_push (cur);
   cur->status = THREAD_READY;
   schedule ();
   intr_set_level (old_level);
@@ -501,20 +511,21 @@ calculate_priority(struct thread * t, void * aux UNUSED)
   val = max(to_fixed_point(PRI_MIN), val);
 
   t->priority = to_int_nearest(val);
+  if(t->status == THREAD_READY && t->ready_priority != t->priority)
+  {
+    // Move it to its new level in place instead of re-sorting.
+    ready_queue_remove(t);
+    ready_queue_push(t);
+  }
   if(debug)
     printf("Priority for %s is %d\n", t->name, t->priority);
 }
 
+/* Returns T's effective priority: its own priority or the
+   highest priority donated to it, whichever is greater. */
 int thread_get_other_priority (struct thread * t)
 {
-  int i, p = t->priority;
-
-  for(i = 0; i < MAX_DONATERS; i++)
-  {
-    p = MAX(p, t->donations[i]);
-  }
-
-  return p;
+  return MAX(t->priority, t->donated_priority);
 }
 
 /* Sets the current thread's nice value to NICE. */
@@ -524,7 +535,14 @@ thread_set_nice (int nice)
   ASSERT(nice >= -20);
   ASSERT(nice <= 20);
 
+  enum intr_level old_level = intr_disable ();
   thread_current()->niceness = nice;
+  calculate_priority(thread_current(), NULL);
+  bool preempted = ready_queue_highest() > thread_current()->priority;
+  intr_set_level (old_level);
+
+  if(preempted)
+    thread_yield();
 }
 
 /* Returns the current thread's nice value. */
@@ -551,6 +569,7 @@ static void
 update_recent_cpu(struct thread * t, void * aux UNUSED)
 {
   t->recent_cpu = calculate_recent_cpu(t->recent_cpu, t->niceness);
+  calculate_priority(t, NULL);
   // printf("Recent cpu for %s is %d\n", t->name, to_int_nearest(t->recent_cpu));
   // TODO: This function writes on threads without synchronization primitive.
   //   Is this safe under all conditions?
@@ -597,6 +616,7 @@ idle (void *idle_started_ UNUSED)
 
          See [IA32-v2a] "HLT", [IA32-v2b] "STI", and [IA32-v3a]
          7.11.1 "HLT Instruction". */
+      timer_idle_enter ();
       asm volatile ("sti; hlt" : : : "memory");
     }
 }
@@ -633,42 +653,56 @@ is_thread (struct thread *t)
   return t != NULL && t->magic == THREAD_MAGIC;
 }
 
-void
-thread_donate(struct thread * t, int priority, int old_priority)
+/* Moves T, if it is in the run queue, to the level of its
+   current effective priority. */
+static void
+ready_queue_update (struct thread * t)
 {
-  int i;
-  for(i = 0; i < MAX_DONATERS; i++)
+  if(t->status == THREAD_READY && t->ready_priority != ready_priority(t))
   {
-    if(t->donations[i] == old_priority)
-    {
-      t->donations[i] = priority;
-      // if(debug)
-      //   printf("Donating %d (was %d) from %d to %d, [%d,%d,%d,...]\n", priority, old_priority, thread_tid(), t->tid, t->donations[0], t->donations[1], t->donations[2]);
-      return;
-    }
+    ready_queue_remove(t);
+    ready_queue_push(t);
   }
-  // if(debug)
-  //   printf("Unable to donate from %d to %d, (s/%d/%d)\n", thread_tid(), t->tid, old_priority, priority);
 }
 
+/* Raises the priority donated to T, through one of the locks it
+   holds, to PRIORITY.  Must be called with interrupts off. */
 void
-thread_revoke_donation(struct thread * t, int priority)
+thread_donate(struct thread * t, int priority)
 {
-  if (priority > 0)
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  if(priority > t->donated_priority)
   {
-    int i;
-    for(i = 0; i < MAX_DONATERS; i++)
-    {
-      if(t->donations[i] == priority)// || t->lock_count < 0)
-      {
-        t->donations[i] = 0;
-        // if(debug)
-        //   printf("Revoking donation %d from %d, [%d,%d,%d,...]\n", priority, t->tid, t->donations[0], t->donations[1], t->donations[2]);
-      }
-    }
+    t->donated_priority = priority;
+    ready_queue_update(t);
   }
 }
 
+/* Recomputes the priority donated to T from the locks it still
+   holds, exclusively or shared, after T released a lock.  Takes
+   time proportional to the number of locks T holds.  Must be
+   called with interrupts off. */
+void
+thread_revoke_donation(struct thread * t)
+{
+  struct list_elem *e;
+  int p = PRI_MIN;
+  int i;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  for (e = list_begin (&t->held_locks); e != list_end (&t->held_locks);
+       e = list_next (e))
+    p = MAX(p, list_entry (e, struct lock, elem)->priority);
+  for (i = 0; i < RWLOCK_HOLD_CNT; i++)
+    if (t->rwlock_holds[i].rwlock != NULL)
+      p = MAX(p, t->rwlock_holds[i].rwlock->priority);
+
+  t->donated_priority = p;
+  ready_queue_update(t);
+}
+
 /* Does basic initialization of T as a blocked thread named
    NAME. */
 static void
@@ -687,9 +721,13 @@ init_thread (struct thread *t, const char *name, int priority)
   t->priority = priority;
   t->magic = THREAD_MAGIC;
   t->recent_cpu = 0;
+  list_init(&t->held_locks);
+  t->donated_priority = PRI_MIN;
+#ifdef USERPROG
   list_init(&t->children);
   list_init(&t->mappedfiles);
   t->mapid = 0;
+#endif
 
   old_level = intr_disable ();
   list_push_back (&all_list, &t->allelem);
@@ -731,6 +769,84 @@ smaller_priority(const struct list_elem *a,
   return t1p <= t2p;
 }
 
+/* Returns the priority level T is queued at in the run queue:
+   the MLFQS priority, or the priority including donations. */
+static int
+ready_priority (struct thread *t)
+{
+  return thread_mlfqs ? t->priority : thread_get_other_priority (t);
+}
+
+/* Appends T to the run queue at the end of its priority level.
+   Threads of equal priority are thus run in FIFO order.
+   Must be called with interrupts off. */
+static void
+ready_queue_push (struct thread *t)
+{
+  int p = ready_priority (t);
+
+  ASSERT (intr_get_level () == INTR_OFF);
+  ASSERT (PRI_MIN <= p && p <= PRI_MAX);
+
+  t->ready_priority = p;
+  list_push_back (&ready_queues[p - PRI_MIN], &t->elem);
+  ready_bitmap[(p - PRI_MIN) / 32] |= 1u << ((p - PRI_MIN) % 32);
+  ready_cnt++;
+}
+
+/* Removes T, which must be in the THREAD_READY state, from the
+   run queue.  Must be called with interrupts off. */
+static void
+ready_queue_remove (struct thread *t)
+{
+  int p = t->ready_priority;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+  ASSERT (t->status == THREAD_READY);
+
+  list_remove (&t->elem);
+  if (list_empty (&ready_queues[p - PRI_MIN]))
+    ready_bitmap[(p - PRI_MIN) / 32] &= ~(1u << ((p - PRI_MIN) % 32));
+  ready_cnt--;
+}
+
+/* Returns the highest priority level with a non-empty run
+   queue, or PRI_MIN - 1 if no thread is ready to run. */
+static int
+ready_queue_highest (void)
+{
+  int i;
+
+  for (i = sizeof ready_bitmap / sizeof *ready_bitmap - 1; i >= 0; i--)
+    if (ready_bitmap[i] != 0)
+      return PRI_MIN + i * 32 + (31 - __builtin_clz (ready_bitmap[i]));
+  return PRI_MIN - 1;
+}
+
+/* Removes and returns the thread at the front of the highest
+   non-empty priority level of the run queue, or a null pointer
+   if no thread is ready to run.  Must be called with interrupts
+   off. */
+static struct thread *
+ready_queue_pop (void)
+{
+  int p = ready_queue_highest ();
+  struct list *queue;
+  struct thread *t;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  if (p < PRI_MIN)
+    return NULL;
+
+  queue = &ready_queues[p - PRI_MIN];
+  t = list_entry (list_pop_front (queue), struct thread, elem);
+  if (list_empty (queue))
+    ready_bitmap[(p - PRI_MIN) / 32] &= ~(1u << ((p - PRI_MIN) % 32));
+  ready_cnt--;
+  return t;
+}
+
 /* Chooses and returns the next thread to be scheduled.  Should
    return a thread from the run queue, unless the run queue is
    empty.  (If the running thread can continue running, then it
@@ -739,18 +855,9 @@ smaller_priority(const struct list_elem *a,
 static struct thread *
 next_thread_to_run (void) 
 {
+  struct thread *t = ready_queue_pop ();
 
-  if (list_empty (&ready_list))
-  {
-    return idle_thread;    
-  }
-  else
-  {
-    struct thread * t;
-    t = list_entry(list_pop_back(&ready_list), struct thread, elem);
-    return t;
-  }
-    
+  return t != NULL ? t : idle_thread;
 }
 
 /* Completes a thread switch by activating the new thread's page
@@ -26,9 +26,6 @@ typedef int mapid_t;
 #define PRI_DEFAULT 31                  /* Default priority. */
 #define PRI_MAX 63                      /* Highest priority. */
 
-/* Maximum number of priority donors*/
-#define MAX_DONATERS 8
-
 /* States in a thread's life cycle. */
 enum thread_status
   {
@@ -38,10 +35,13 @@ enum thread_status
     THREAD_DYING        /* About to be destroyed. */
   };
 
+struct dir;
+
 /* An open file owned by a process */
 struct thread_file 
   {
     struct file * fdfile;   /* Pointer to kernel data structure */
+    struct dir * fddir;     /* Directory, if the file is one */
     int fd;                 /* File descriptor passed to the program */
     struct list_elem elem;  /* List element */
   };
@@ -131,9 +131,14 @@ struct thread
     int priority;                       /* Priority. */
     struct list_elem allelem;           /* List element for all threads list. */
     int64_t ticks;                      /* Wakeup time */
+    struct thread *sleep_child;         /* Sleep heap: first child. */
+    struct thread *sleep_sibling;       /* Sleep heap: next sibling. */
+    int ready_priority;                 /* Run queue level while ready. */
 
     struct lock * waiting_on_lock;      /* The lock the thread waits for */
-    int donations[MAX_DONATERS];        /* Up to 8 donated priorities */
+    struct list held_locks;             /* Locks held, for donation */
+    int donated_priority;               /* Highest priority of held_locks */
+    struct rwlock_hold rwlock_holds[RWLOCK_HOLD_CNT]; /* Shared holds */
 
     int niceness;
     fixed_point recent_cpu;
@@ -150,6 +155,7 @@ struct thread
     struct thread * parent;             /* Parent thread */
     struct list children;               /* A list of children */
     struct file * executable;           /* The threads executable */
+    struct dir * cwd;                   /* Current directory, or null for root */
     int return_value;                   /* Return value for parent */
 
     struct list mappedfiles;            /* A list of memory mapped files*/
@@ -174,6 +180,7 @@ void thread_init (void);
 void thread_start (void);
 
 void thread_tick (void);
+void thread_idle_ticks (int64_t cnt);
 void thread_print_stats (void);
 void thread_print_info(struct thread * t, void* aux);
 
@@ -198,8 +205,8 @@ void thread_foreach (thread_action_func *, void *);
 int thread_get_priority (void);
 int thread_get_other_priority (struct thread * t);
 void thread_set_priority (int);
-void thread_donate (struct thread * t, int priority, int old_priority);
-void thread_revoke_donation(struct thread * t, int priority);
+void thread_donate (struct thread * t, int priority);
+void thread_revoke_donation(struct thread * t);
 
 int thread_get_nice (void);
 void thread_set_nice (int);
@@ -110,6 +110,10 @@ start_process (void *process_data_)
   /* Initialize supplemental page table */
   hash_init(&t->pages, page_hash, page_less, NULL);
 
+  /* Inherit the parent's current directory */
+  if (pd->parent->cwd != NULL)
+    t->cwd = dir_reopen(pd->parent->cwd);
+
   /* Initialize interrupt frame and load executable. */
   memset (&if_, 0, sizeof if_);
   if_.gs = if_.fs = if_.es = if_.ds = if_.ss = SEL_UDSEG;
@@ -184,9 +188,12 @@ process_exit (void)
     struct list_elem *e = list_pop_back(&cur->thread_files);
     struct thread_file *tf = list_entry(e, struct thread_file, elem);
 
+    dir_close(tf->fddir);
     file_close(tf->fdfile);
     free(tf);
   }
+  dir_close(cur->cwd);
+  cur->cwd = NULL;
 
   /* Free all metadata for child processes */
   while(!list_empty(&cur->children))
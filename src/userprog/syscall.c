@@ -10,10 +10,13 @@
 #include "threads/vaddr.h"
 #include "userprog/pagedir.h"
 #include "userprog/process.h"
+#include "filesys/directory.h"
 #include "filesys/filesys.h"
+#include "filesys/inode.h"
 #include "threads/thread.h"
 #include "threads/malloc.h"
 #include "threads/synch.h"
+#include "devices/block.h"
 #include "devices/input.h"
 #include "vm/page.h"
 #include "vm/frame.h"
@@ -25,13 +28,11 @@ mapid_t mmap (int fd, void *addr);
 void munmap (mapid_t mapping);
 struct thread_file * get_thread_file (int fd);
 static char *get_syscall_name(int syscall_nr);
-struct lock syscall_lock;	/* A lock for system calls */
 
 void
 syscall_init (void) 
 {
   intr_register_int (0x30, 3, INTR_ON, syscall_handler, "syscall");
-  lock_init(&syscall_lock);
 }
 
 static bool
@@ -108,10 +109,8 @@ syscall_handler (struct intr_frame *f)
 			if (file == NULL || !is_valid_user_pointer ((const void *) file))
 				userprog_fail (f);
 
-			lock_acquire (&syscall_lock);
 			pid_t pid = process_execute (file);
 			f->eax = pid;
-			lock_release (&syscall_lock);
 			
 			break;
 		}
@@ -139,9 +138,7 @@ syscall_handler (struct intr_frame *f)
 			if(!is_valid_user_pointer((unsigned *) f->esp + 2))
 				userprog_fail (f);
 			unsigned initial_size = *((unsigned *) f->esp + 2);
-			lock_acquire (&syscall_lock);
 			bool ret = filesys_create (file, initial_size);
-			lock_release (&syscall_lock);
 			f->eax = ret;
 
 			break;
@@ -155,9 +152,7 @@ syscall_handler (struct intr_frame *f)
 			if (file == NULL || !is_valid_user_pointer (file))
 				userprog_fail (f);
 
-			lock_acquire (&syscall_lock);
 			bool ret = filesys_remove (file);
-			lock_release (&syscall_lock);
 			f->eax = ret;
 
 			break;
@@ -174,23 +169,25 @@ syscall_handler (struct intr_frame *f)
 			struct thread_file * tf = malloc(sizeof (struct thread_file));
 			struct file *file;
 
-			lock_acquire (&syscall_lock);
 			file = filesys_open (file_name);
 
 			if(file == NULL)
 			{
 				f->eax = -1;
-				lock_release (&syscall_lock);
 			}
 			else
 			{
+				struct inode * inode = file_get_inode (file);
+
 				tf->fdfile = file;
+				tf->fddir = NULL;
+				if (inode_is_dir (inode))
+					tf->fddir = dir_open (inode_reopen (inode));
 
 				tf->fd = current->last_fd;
 				current->last_fd++;
 
 				list_push_back (&current->thread_files, &tf->elem);
-				lock_release (&syscall_lock);
 
 				f->eax = tf->fd;
 			}
@@ -204,14 +201,11 @@ syscall_handler (struct intr_frame *f)
 
 			int fd = *((int *) f->esp + 1);
 
-			lock_acquire (&syscall_lock);
 			struct thread_file * current_tf = get_thread_file (fd);
 
 			if (current_tf != NULL)
 				f->eax = file_length (current_tf->fdfile);
 
-			lock_release (&syscall_lock);
-
 			break;
 		}
 		case SYS_READ:
@@ -235,10 +229,13 @@ syscall_handler (struct intr_frame *f)
 				userprog_fail(f);
 
 
-			lock_acquire (&syscall_lock);
 			struct thread_file * current_tf = get_thread_file (fd);
 
-			if (current_tf != NULL)
+			if (current_tf != NULL && current_tf->fddir != NULL)
+			{
+				f->eax = -1;
+			}
+			else if (current_tf != NULL)
 			{
 				f->eax = file_read (current_tf->fdfile, buf, size);
 			}
@@ -256,8 +253,6 @@ syscall_handler (struct intr_frame *f)
 			}
 			// printf("\tRead %d bytes\n", f->eax);
 
-			lock_release (&syscall_lock);
-
 			break;
 		}
 		case SYS_WRITE:
@@ -280,10 +275,13 @@ syscall_handler (struct intr_frame *f)
 			if(!is_valid_user_pointer_range(buf, size))
 				userprog_fail(f);
 
-			lock_acquire (&syscall_lock);
 			struct thread_file * current_tf = get_thread_file (fd);
 
-			if (current_tf != NULL)
+			if (current_tf != NULL && current_tf->fddir != NULL)
+			{
+				f->eax = -1;
+			}
+			else if (current_tf != NULL)
 			{
 				f->eax = file_write (current_tf->fdfile, buf, size);
 			}
@@ -293,8 +291,6 @@ syscall_handler (struct intr_frame *f)
 				f->eax = size;
 			}
 
-			lock_release (&syscall_lock);
-
 			break;
 		}
 		case SYS_SEEK:
@@ -307,13 +303,11 @@ syscall_handler (struct intr_frame *f)
 				userprog_fail (f);
 			unsigned position = *((unsigned *) f->esp + 2);
 
-			lock_acquire (&syscall_lock);
 			struct thread_file * current_tf = get_thread_file (fd);
 
 			if (current_tf != NULL)
 				file_seek (current_tf->fdfile, position);
 
-			lock_release (&syscall_lock);
 			
 			break;
 		}
@@ -323,14 +317,11 @@ syscall_handler (struct intr_frame *f)
 				userprog_fail (f);
 			int fd = *((int *)f->esp + 1);
 
-			lock_acquire (&syscall_lock);
 			struct thread_file * current_tf = get_thread_file (fd);
 
 			if (current_tf != NULL)
 				f->eax = file_tell (current_tf->fdfile);
 
-			lock_release (&syscall_lock);
-
 			break;
 		}
 		case SYS_CLOSE:
@@ -339,18 +330,16 @@ syscall_handler (struct intr_frame *f)
 				userprog_fail (f);
 			int fd = *((int *)f->esp + 1);
 
-			lock_acquire (&syscall_lock);
 			struct thread_file * current_tf = get_thread_file (fd);
 
 			if (current_tf != NULL)
 			{
 				list_remove (&current_tf->elem);
+				dir_close (current_tf->fddir);
 				file_close (current_tf->fdfile);
 				free (current_tf);
 			}
 
-			lock_release (&syscall_lock);
-
 			break;
 		}
 		case SYS_MMAP:
@@ -383,6 +372,132 @@ syscall_handler (struct intr_frame *f)
 				thread_current()->mapid++;
 			break;
 		}
+		case SYS_CHDIR:
+		{
+			if(!is_valid_user_pointer((char **) f->esp + 1))
+				userprog_fail (f);
+			char * dir = *((char **) f->esp + 1);
+
+			if (dir == NULL || !is_valid_user_pointer (dir))
+				userprog_fail (f);
+
+			f->eax = filesys_chdir (dir);
+
+			break;
+		}
+		case SYS_MKDIR:
+		{
+			if(!is_valid_user_pointer((char **) f->esp + 1))
+				userprog_fail (f);
+			char * dir = *((char **) f->esp + 1);
+
+			if (dir == NULL || !is_valid_user_pointer (dir))
+				userprog_fail (f);
+
+			f->eax = filesys_mkdir (dir);
+
+			break;
+		}
+		case SYS_READDIR:
+		{
+			if(!is_valid_user_pointer((int *) f->esp + 1))
+				userprog_fail (f);
+			int fd = *((int *)f->esp + 1);
+
+			if(!is_valid_user_pointer((char **) f->esp + 2))
+				userprog_fail (f);
+			char * name = *((char **)f->esp + 2);
+
+			if(name == NULL || !is_valid_user_pointer_range(name, READDIR_MAX_LEN + 1))
+				userprog_fail (f);
+
+			struct thread_file * current_tf = get_thread_file (fd);
+
+			f->eax = false;
+			if (current_tf != NULL && current_tf->fddir != NULL)
+			{
+				/* Read into a kernel buffer, so that the directory's
+				   lock is not held across a page fault on NAME */
+				char entry[NAME_MAX + 1];
+
+				if (dir_readdir (current_tf->fddir, entry))
+				{
+					strlcpy (name, entry, READDIR_MAX_LEN + 1);
+					f->eax = true;
+				}
+			}
+
+			break;
+		}
+		case SYS_ISDIR:
+		{
+			if(!is_valid_user_pointer((int *) f->esp + 1))
+				userprog_fail (f);
+			int fd = *((int *)f->esp + 1);
+
+			struct thread_file * current_tf = get_thread_file (fd);
+
+			f->eax = current_tf != NULL && current_tf->fddir != NULL;
+
+			break;
+		}
+		case SYS_INUMBER:
+		{
+			if(!is_valid_user_pointer((int *) f->esp + 1))
+				userprog_fail (f);
+			int fd = *((int *)f->esp + 1);
+
+			struct thread_file * current_tf = get_thread_file (fd);
+
+			f->eax = -1;
+			if (current_tf != NULL)
+				f->eax = inode_get_inumber (file_get_inode (current_tf->fdfile));
+
+			break;
+		}
+		case SYS_FSYNC:
+		{
+			if(!is_valid_user_pointer((int *) f->esp + 1))
+				userprog_fail (f);
+			int fd = *((int *)f->esp + 1);
+
+			struct thread_file * current_tf = get_thread_file (fd);
+
+			f->eax = false;
+			if (current_tf != NULL)
+			{
+				file_flush (current_tf->fdfile);
+				f->eax = true;
+			}
+
+			break;
+		}
+		case SYS_BLOCK_STATS:
+		{
+			if(!is_valid_user_pointer((char **) f->esp + 1))
+				userprog_fail (f);
+			char * name = *((char **)f->esp + 1);
+			if(name == NULL || !is_valid_user_pointer(name))
+				userprog_fail (f);
+
+			if(!is_valid_user_pointer((struct block_stats **) f->esp + 2))
+				userprog_fail (f);
+			struct block_stats * stats = *((struct block_stats **)f->esp + 2);
+			if(stats == NULL || !is_valid_user_pointer_range(stats, sizeof *stats))
+				userprog_fail (f);
+
+			/* Gather the statistics in a kernel buffer, so that
+			   interrupts are not turned off across a page fault */
+			char kname[sizeof stats->name];
+			struct block_stats kstats;
+			strlcpy (kname, name, sizeof kname);
+
+			f->eax = block_get_stats (kname, &kstats);
+			if (f->eax)
+				memcpy (stats, &kstats, sizeof kstats);
+
+			break;
+		}
 		case SYS_MUNMAP:
 		{                                
 			if(!is_valid_user_pointer((int *) f->esp + 1))
@@ -583,6 +698,20 @@ get_syscall_name(int syscall_nr)
 			return "SYS_MMAP";
 		case SYS_MUNMAP:
 			return "SYS_MUNMAP";
+		case SYS_CHDIR:
+			return "SYS_CHDIR";
+		case SYS_MKDIR:
+			return "SYS_MKDIR";
+		case SYS_READDIR:
+			return "SYS_READDIR";
+		case SYS_ISDIR:
+			return "SYS_ISDIR";
+		case SYS_INUMBER:
+			return "SYS_INUMBER";
+		case SYS_FSYNC:
+			return "SYS_FSYNC";
+		case SYS_BLOCK_STATS:
+			return "SYS_BLOCK_STATS";
 		default:
 			return "Unknown syscall";
 	}
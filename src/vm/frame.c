@@ -21,7 +21,7 @@ void
 frame_init(void)
 {
 	list_init(&frame_list);
-	lock_init(&frame_lock);
+	lock_init(&frame_lock, "frame");
 }
 
 struct frame_entry *
@@ -1,9 +1,12 @@
 #include <inttypes.h>
 #include <debug.h>
+#include <list.h>
 #include <stdio.h>
+#include <string.h>
 
 #include "vm/swap.h"
 #include "devices/block.h"
+#include "threads/malloc.h"
 #include "threads/palloc.h"
 #include "threads/vaddr.h"
 #include "threads/synch.h"
@@ -20,11 +23,31 @@ struct free_slot
 	block_sector_t next;	/* Pointer to the next free slot */
 };
 
+/* A page being written to swap in the background, from a copy,
+   so that the frame can be reused before the write completes */
+struct swap_write
+{
+	struct block_request req;	/* Block request */
+	block_sector_t slot;		/* Slot being written */
+	void * copy;			/* Copy of the page */
+	struct list_elem elem;		/* Element in pending_writes */
+};
+
+static struct list pending_writes;	/* Writes in flight */
+static struct lock pending_lock;	/* Protects pending_writes */
+static struct condition write_done;	/* Signaled when a write completes */
+
+static void write_complete(struct block_request *);
+static void wait_for_write(block_sector_t);
+
 void
 swap_init(void)
 {
 	swap_device = block_get_role(BLOCK_SWAP);
-	lock_init(&swap_lock);
+	lock_init(&swap_lock, "swap");
+	list_init(&pending_writes);
+	lock_init(&pending_lock, "swap writes");
+	cond_init(&write_done);
 	free_list = 0;
 	unused = 0;
 }
@@ -32,7 +55,6 @@ swap_init(void)
 block_sector_t
 swap_store(void * page)
 {
-	int i;
 	lock_acquire(&swap_lock);
 	if (free_list == unused && unused == block_size(swap_device))
 		PANIC ("Swap is full!");
@@ -50,27 +72,81 @@ swap_store(void * page)
 	}
 	palloc_free_page(p);
 
-	for(i = 0; i < PGSIZE/BLOCK_SECTOR_SIZE; i++)
+	/* Write a copy of the page in the background, so that the
+	   caller can reuse the frame, and fault in another page,
+	   while the swap disk is busy.  Without memory for the copy,
+	   write the page itself and wait. */
+	struct swap_write * w = malloc(sizeof *w);
+	void * copy = w != NULL ? palloc_get_page(0) : NULL;
+	if(copy != NULL)
 	{
-		block_write(swap_device, f + i, page + i * BLOCK_SECTOR_SIZE);
+		memcpy(copy, page, PGSIZE);
+		w->slot = f;
+		w->copy = copy;
+		block_request_init(&w->req, swap_device, f, PGSIZE/BLOCK_SECTOR_SIZE, copy, true);
+		w->req.callback = write_complete;
+		w->req.aux = w;
+
+		lock_acquire(&pending_lock);
+		list_push_back(&pending_writes, &w->elem);
+		lock_release(&pending_lock);
+		block_submit(&w->req);
+	}
+	else
+	{
+		free(w);
+		block_write_multiple(swap_device, f, PGSIZE/BLOCK_SECTOR_SIZE, page);
 	}
 
 	lock_release(&swap_lock);
 	return f;
 }
 
+/* Called by the disk driver when the write of a page to swap
+   completes */
+static void
+write_complete(struct block_request * req)
+{
+	struct swap_write * w = req->aux;
+
+	lock_acquire(&pending_lock);
+	list_remove(&w->elem);
+	cond_broadcast(&write_done, &pending_lock);
+	lock_release(&pending_lock);
+
+	palloc_free_page(w->copy);
+	free(w);
+}
+
+/* Waits until no write to SLOT_NO is in flight.  Requests to the
+   disk may complete in any order, so a slot must not be read or
+   reused before its page is on disk. */
+static void
+wait_for_write(block_sector_t slot_no)
+{
+	lock_acquire(&pending_lock);
+	for(;;)
+	{
+		struct list_elem * e;
+		bool pending = false;
+
+		for(e = list_begin(&pending_writes); e != list_end(&pending_writes); e = list_next(e))
+			if(list_entry(e, struct swap_write, elem)->slot == slot_no)
+				pending = true;
+		if(!pending)
+			break;
+		cond_wait(&write_done, &pending_lock);
+	}
+	lock_release(&pending_lock);
+}
+
 void
 swap_retrieve(block_sector_t slot_no, void * page)
 {
-	int i;
+	wait_for_write(slot_no);
 	lock_acquire(&swap_lock);
 	if(page != NULL)
-	{
-		for(i = 0; i < PGSIZE/BLOCK_SECTOR_SIZE; i++)
-		{
-			block_read(swap_device, slot_no + i, page + i * BLOCK_SECTOR_SIZE);
-		}
-	}
+		block_read_multiple(swap_device, slot_no, PGSIZE/BLOCK_SECTOR_SIZE, page);
 
 	struct free_slot f;
 	f.next = free_list;